@@ -0,0 +1,136 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "bytecode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_HAS_AVX2 1
+#endif
+
+// 按列批量求值：一个表达式作用在多行数据上，每条指令一次处理一个块
+// 除法与VM一致，都是IEEE语义 (x/0 = ±inf, 0/0 = NaN)
+class BatchVM {
+   public:
+    static const size_t BLOCK = 512;  // 每块的行数
+
+    BatchVM(const Bytecode::Program& program) : program(program) {
+    }
+
+    // columns[i] 指向变量槽i的列，每列rows个值；结果写入out
+    void run(const double* const* columns, size_t rows, double* out, unsigned threads = 1) const {
+        if (threads <= 1 || rows < 2 * BLOCK) {
+            runRange(columns, 0, rows, out);
+            return;
+        }
+
+        // 按块对齐切分给各个线程
+        size_t blocks = (rows + BLOCK - 1) / BLOCK;
+        size_t perThread = (blocks + threads - 1) / threads * BLOCK;
+        std::vector<std::thread> workers;
+        for (size_t begin = 0; begin < rows; begin += perThread) {
+            size_t end = std::min(rows, begin + perThread);
+            workers.emplace_back([this, columns, begin, end, out]() { runRange(columns, begin, end, out); });
+        }
+        for (auto& t : workers)
+            t.join();
+    }
+
+   private:
+    Bytecode::Program program;
+
+    void runRange(const double* const* columns, size_t begin, size_t end, double* out) const {
+        // 每个栈槽一个块大小的缓冲区；LOAD直接引用列数据，不复制
+        std::vector<double> scratch(program.maxStack * BLOCK);
+        std::vector<const double*> src(program.maxStack);
+        const Bytecode::Instr* code = program.code.data();
+        size_t last = program.code.size() - 1;
+
+        for (size_t base = begin; base < end; base += BLOCK) {
+            size_t n = std::min(BLOCK, end - base);
+            size_t sp = 0;
+            for (size_t pc = 0; pc <= last; ++pc) {
+                const Bytecode::Instr& instr = code[pc];
+                double* dst = pc == last ? out + base : nullptr;
+                if (instr.op == Bytecode::LOAD) {
+                    src[sp++] = columns[instr.arg] + base;
+                } else if (instr.op == Bytecode::CONST) {
+                    double* buf = scratch.data() + sp * BLOCK;
+                    std::fill(buf, buf + n, program.consts[instr.arg]);
+                    src[sp++] = buf;
+                } else {
+                    sp--;
+                    if (dst == nullptr)
+                        dst = scratch.data() + (sp - 1) * BLOCK;
+                    kernel(instr.op, src[sp - 1], src[sp], dst, n);
+                    src[sp - 1] = dst;
+                }
+                if (pc == last && dst != src[0])
+                    std::copy(src[0], src[0] + n, out + base);
+            }
+        }
+    }
+
+    static void kernel(Bytecode::OpCode op, const double* a, const double* b, double* dst, size_t n) {
+#ifdef BATCH_HAS_AVX2
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2) {
+            kernelAVX2(op, a, b, dst, n);
+            return;
+        }
+#endif
+        kernelScalar(op, a, b, dst, 0, n);
+    }
+
+    static void kernelScalar(Bytecode::OpCode op, const double* a, const double* b, double* dst, size_t i, size_t n) {
+        switch (op) {
+            case Bytecode::ADD:
+                for (; i < n; ++i)
+                    dst[i] = a[i] + b[i];
+                break;
+            case Bytecode::SUB:
+                for (; i < n; ++i)
+                    dst[i] = a[i] - b[i];
+                break;
+            case Bytecode::MUL:
+                for (; i < n; ++i)
+                    dst[i] = a[i] * b[i];
+                break;
+            default:
+                for (; i < n; ++i)
+                    dst[i] = a[i] / b[i];
+                break;
+        }
+    }
+
+#ifdef BATCH_HAS_AVX2
+    __attribute__((target("avx2"))) static void kernelAVX2(Bytecode::OpCode op, const double* a, const double* b, double* dst, size_t n) {
+        size_t i = 0;
+        switch (op) {
+            case Bytecode::ADD:
+                for (; i + 4 <= n; i += 4)
+                    _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+                break;
+            case Bytecode::SUB:
+                for (; i + 4 <= n; i += 4)
+                    _mm256_storeu_pd(dst + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+                break;
+            case Bytecode::MUL:
+                for (; i + 4 <= n; i += 4)
+                    _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+                break;
+            default:
+                for (; i + 4 <= n; i += 4)
+                    _mm256_storeu_pd(dst + i, _mm256_div_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+                break;
+        }
+        kernelScalar(op, a, b, dst, i, n);
+    }
+#endif
+};
+
+#endif  // __BATCH_H__
@@ -0,0 +1,664 @@
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "batch.h"
+#include "binfmt.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "lang.h"
+#include "lexical.h"
+#include "lineindex.h"
+#include "symbol.h"
+#include "syntax.h"
+
+const std::vector<std::string> expressions = {
+    "x+1",
+    "(x+1.5)*y-z/4+2*3",
+    "(a+b)*(c-d)/(e+1)-a*b*c+(2+3)*(4-1)*d",
+    "a/(b-(c*(d+(a/(b-(c*(d+(a/(b-(c*(d+1)))))))))))",
+};
+
+double seconds(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// 以VM为参照逐位比较按列批量求值与JIT的结果，bindings为行优先的rows行
+// 批量求值再取少1到3行各跑一次，让最后一块的尾部走标量核
+int verify(const Bytecode::Program& program, const BatchVM& batch, JIT* jit, const std::vector<double>& bindings, size_t rows) {
+    size_t width = program.vars.size();
+    std::vector<std::vector<double>> columns(width, std::vector<double>(rows));
+    std::vector<const double*> columnPtrs;
+    for (size_t v = 0; v < width; ++v) {
+        for (size_t i = 0; i < rows; ++i)
+            columns[v][i] = bindings[i * width + v];
+        columnPtrs.push_back(columns[v].data());
+    }
+    VM vm(program);
+    std::vector<double> expected(rows);
+    for (size_t i = 0; i < rows; ++i)
+        expected[i] = vm.run(bindings.data() + i * width);
+
+    std::vector<double> out(rows);
+    for (size_t count = rows; count + 4 > rows && count > 0; --count) {
+        batch.run(columnPtrs.data(), count, out.data());
+        for (size_t i = 0; i < count; ++i) {
+            if (std::memcmp(&out[i], &expected[i], sizeof(double)) != 0) {
+                std::cout << "  batch mismatch at row " << i << " of " << count << ": " << out[i] << " vs " << expected[i] << "\n";
+                return 1;
+            }
+        }
+    }
+    if (jit != nullptr) {
+        for (size_t i = 0; i < rows; ++i) {
+            double got = (*jit)(bindings.data() + i * width);
+            if (std::memcmp(&got, &expected[i], sizeof(double)) != 0) {
+                std::cout << "  jit mismatch at row " << i << ": " << got << " vs " << expected[i] << "\n";
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// 逐行VM、分层JIT与按列批量求值
+int benchEvaluation(const Lexical& lexical, const Syntax& syntax) {
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> dist(-100, 100);
+
+    const size_t rows = 1 << 12;
+    const size_t rounds = 1 << 10;
+
+    for (const auto& expr : expressions) {
+        auto tree = syntax.buildTree(classifyTokens(lexical.scanTokens(expr), expr, syntax), expr);
+        Bytecode::Program program = Bytecode::compile(tree.get());
+
+        // 预先生成多组变量绑定，行优先存放
+        size_t width = program.vars.size();
+        std::vector<double> bindings(rows * (width == 0 ? 1 : width));
+        for (auto& v : bindings)
+            v = dist(rng);
+
+        VM vm(program);
+        double sum = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < rows; ++i)
+                sum += vm.run(bindings.data() + i * width);
+        double elapsed = seconds(begin);
+
+        std::cout << expr << "\n"
+                  << "  instrs: " << program.code.size() << ", vars: " << width << "\n"
+                  << "  vm: " << (rows * rounds) / elapsed / 1e6 << " M evals/s (checksum " << sum << ")\n";
+
+        // 同样的数据转成按列存放，批量求值并与逐行结果逐位比较
+        std::vector<std::vector<double>> columns(width, std::vector<double>(rows));
+        std::vector<const double*> columnPtrs;
+        for (size_t v = 0; v < width; ++v) {
+            for (size_t i = 0; i < rows; ++i)
+                columns[v][i] = bindings[i * width + v];
+            columnPtrs.push_back(columns[v].data());
+        }
+        BatchVM batch(program);
+        JIT* jit = JIT::compile(program);
+        if (verify(program, batch, jit, bindings, rows) != 0)
+            return 1;
+
+        // 隔行放入0、-0.0、NaN与普通值的各种组合，检查x/0、0/0和NaN的传播
+        const double specials[] = {0.0, -0.0, std::nan(""), 2.5};
+        std::vector<double> edges = bindings;
+        for (size_t i = 0; i < rows; i += 2)
+            for (size_t v = 0, k = i / 2; v < width; ++v, k /= 4)
+                edges[i * width + v] = specials[k % 4];
+        if (verify(program, batch, jit, edges, rows) != 0)
+            return 1;
+        delete jit;
+
+        TieredExpr tiered(program);
+        sum = 0;
+        begin = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < rows; ++i)
+                sum += tiered.run(bindings.data() + i * width);
+        elapsed = seconds(begin);
+        std::cout << "  tiered (" << (tiered.compiled() ? "jit" : "vm") << "): " << (rows * rounds) / elapsed / 1e6
+                  << " M evals/s (checksum " << sum << ")\n";
+
+        unsigned cores = std::thread::hardware_concurrency();
+        for (unsigned threads : {1u, cores}) {
+            std::vector<double> big(rows * rounds / 4);
+            std::vector<std::vector<double>> bigColumns(width, std::vector<double>(big.size()));
+            std::vector<const double*> bigPtrs;
+            for (size_t v = 0; v < width; ++v) {
+                for (size_t i = 0; i < big.size(); ++i)
+                    bigColumns[v][i] = columns[v][i % rows];
+                bigPtrs.push_back(bigColumns[v].data());
+            }
+            begin = std::chrono::steady_clock::now();
+            for (int r = 0; r < 4; ++r)
+                batch.run(bigPtrs.data(), big.size(), big.data(), threads);
+            elapsed = seconds(begin);
+            std::cout << "  batch (" << threads << " threads): " << (big.size() * 4) / elapsed / 1e6 << " M evals/s\n";
+            if (cores <= 1)
+                break;
+        }
+    }
+    return 0;
+}
+
+// 结点的孩子，与结点同名的孩子(长尾链treap的左右子树)换成它们的孩子，比较时不受treap形状的影响
+void flatChildren(const Syntax::TreeNode* node, const std::string& symbol, std::vector<const Syntax::TreeNode*>& out) {
+    for (const auto& child : node->children)
+        if (child->symbol == symbol)
+            flatChildren(child.get(), symbol, out);
+        else
+            out.push_back(child.get());
+}
+
+bool sameTree(const Syntax::TreeNode* a, const Syntax::TreeNode* b) {
+    std::vector<std::pair<const Syntax::TreeNode*, const Syntax::TreeNode*>> stack = {{a, b}};
+    std::vector<const Syntax::TreeNode*> left, right;
+    while (!stack.empty()) {
+        auto pair = stack.back();
+        stack.pop_back();
+        if (pair.first == pair.second)
+            continue;
+        left.clear();
+        right.clear();
+        flatChildren(pair.first, pair.first->symbol, left);
+        flatChildren(pair.second, pair.second->symbol, right);
+        if (pair.first->symbol != pair.second->symbol || pair.first->lexeme != pair.second->lexeme ||
+            pair.first->size != pair.second->size || left.size() != right.size())
+            return false;
+        for (size_t i = 0; i < left.size(); ++i)
+            stack.push_back({left[i], right[i]});
+    }
+    return true;
+}
+
+// terms项的大表达式，加减乘除与括号交替出现；spaced为true时运算符两边带空格，除数为小数
+std::string corpus(int terms, bool spaced = false) {
+    const char* sep = spaced ? " " : "";
+    std::string code = "x0";
+    for (int i = 1; i < terms; ++i) {
+        std::string term = (i % 3 == 2 ? "x" : "(x") + std::to_string(i);
+        if (i % 3 != 2)
+            term += sep + std::string(i % 2 ? "-" : "/") + sep + (i % 2 ? "1" : spaced ? "2.5" : "2") + ")";
+        code += sep + std::string(i % 3 == 0 ? "*" : i % 3 == 1 ? "+" : "-") + sep + term;
+    }
+    return code;
+}
+
+// 把记号[at, at + remove)换成text后的源码，text两边加空格，不和相邻的记号连成一个
+std::string splice(const std::string& code, const std::vector<Lexical::Token>& tokens, size_t at, size_t remove, const std::string& text) {
+    size_t begin = at < tokens.size() ? tokens[at].offset : code.size();
+    size_t end = at + remove < tokens.size() ? tokens[at + remove].offset : code.size();
+    return code.substr(0, begin) + " " + text + " " + code.substr(end);
+}
+
+// 大表达式上的小修改：增量分析与整棵树重建的耗时，结果必须与重建相同
+int benchReparse(const Lexical& lexical, const Syntax& syntax) {
+    std::string code = corpus(20000);
+    auto tokens = classifyTokens(lexical.scanTokens(code), code, syntax);
+    auto tree = syntax.buildTree(tokens, code);
+
+    // (编辑位置, 删除的记号数, 插入的源码)
+    struct Edit {
+        size_t at;
+        size_t remove;
+        std::string insert;
+    };
+    // 在"+"前插入/替换，保证修改后仍然合法；另外各有一次开头处和末尾处的修改
+    const uint32_t plus = syntax.terminal("+");
+    auto plusNear = [&](size_t at) {
+        while ((uint32_t)tokens[at].type != plus)
+            at++;
+        return at;
+    };
+    std::vector<Edit> edits = {
+        {plusNear(tokens.size() / 2), 1, "-"},
+        {plusNear(tokens.size() / 3), 0, "+ y"},
+        {plusNear(tokens.size() / 4), 0, "* (3 - z)"},
+        {tokens.size(), 0, "+ z"},
+        {0, 1, "1"},
+        {tokens.size() / 2, 1, ")"},
+    };
+
+    std::cout << "reparse (" << tokens.size() << " tokens)\n";
+    for (const auto& edit : edits) {
+        std::string source = splice(code, tokens, edit.at, edit.remove, edit.insert);
+        auto edited = classifyTokens(lexical.scanTokens(source), source, syntax);
+        size_t inserted = edited.size() + edit.remove - tokens.size();
+
+        auto begin = std::chrono::steady_clock::now();
+        auto full = syntax.buildTree(edited, source);
+        double fullTime = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        auto incremental = syntax.reparse(tree, edited, source, edit.at, edit.at + edit.remove, edit.at + inserted);
+        double incrementalTime = seconds(begin);
+
+        if ((full == nullptr) != (incremental == nullptr) || (full != nullptr && !sameTree(full.get(), incremental.get()))) {
+            std::cout << "  reparse mismatch at " << edit.at << "\n";
+            return 1;
+        }
+        std::cout << "  edit at " << edit.at << ": full " << fullTime * 1e3 << " ms, incremental " << incrementalTime * 1e3 << " ms"
+                  << (full == nullptr ? " (syntax error)" : "") << "\n";
+    }
+
+    // 同样的修改(文件中间把"+"换成"-")在不同长度的输入上：整体分析随长度增长，增量分析应当基本不变
+    // 各取3次中最快的一次，排除分配器整理内存等一次性的开销
+    std::cout << "reparse scaling\n";
+    for (int terms : {2000, 20000, 200000}) {
+        std::string input = corpus(terms);
+        auto inputTokens = classifyTokens(lexical.scanTokens(input), input, syntax);
+        auto base = syntax.buildTree(inputTokens, input);
+        size_t at = inputTokens.size() / 2;
+        while ((uint32_t)inputTokens[at].type != plus)
+            at++;
+        std::string source = splice(input, inputTokens, at, 1, "-");
+        auto edited = classifyTokens(lexical.scanTokens(source), source, syntax);
+        double fullTime = 1e9, incrementalTime = 1e9;
+        std::shared_ptr<Syntax::TreeNode> full, incremental;
+        for (int r = 0; r < 3; ++r) {
+            auto begin = std::chrono::steady_clock::now();
+            full = syntax.buildTree(edited, source);
+            fullTime = std::min(fullTime, seconds(begin));
+            begin = std::chrono::steady_clock::now();
+            incremental = syntax.reparse(base, edited, source, at, at + 1, at + 1);
+            incrementalTime = std::min(incrementalTime, seconds(begin));
+        }
+        if (full == nullptr || incremental == nullptr || !sameTree(full.get(), incremental.get())) {
+            std::cout << "  reparse mismatch at " << at << " (" << inputTokens.size() << " tokens)\n";
+            return 1;
+        }
+        std::cout << "  " << inputTokens.size() << " tokens: full " << fullTime * 1e3 << " ms, incremental " << incrementalTime * 1e3 << " ms\n";
+    }
+    return 0;
+}
+
+// 文法变换前后每个记号的栈操作次数；两种文法的接受结果和求值结果必须相同
+int benchGrammar(const Lexical& lexical, const Syntax& syntax) {
+    Syntax optimized = Syntax(productions, terminals, nonTerminals, startSymbol, true);
+    std::cout << "optimized grammar\n";
+    optimized.displayProductions();
+
+    std::vector<std::string> inputs(std::begin(expressions), std::end(expressions));
+    inputs.push_back(corpus(20000));
+    for (const char* bad : {"x+", "(x*2", "x y", ")", "1+(2*)", ""})
+        inputs.push_back(bad);
+
+    std::mt19937_64 rng(3);
+    std::uniform_real_distribution<double> dist(-100, 100);
+    long long tokenCount = 0, opsBefore[2] = {0, 0}, opsAfter[2] = {0, 0};
+    double timeBefore = 0, timeAfter = 0;
+    Stats::enabled = true;
+    for (const auto& input : inputs) {
+        // 两种文法的树用同一组符号编号，变量槽按编号对应
+        SymbolTable names;
+        internKeywords(names);
+        auto scanned = lexical.scanTokens(input, names, TokenType::Identifier);
+        std::ostringstream sink;
+        const Syntax* grammars[2] = {&syntax, &optimized};
+        bool accepted[2];
+        std::shared_ptr<Syntax::TreeNode> trees[2];
+        for (int g = 0; g < 2; ++g) {
+            long long* ops = g == 0 ? opsBefore : opsAfter;
+            auto tokens = classifyTokens(scanned, input, *grammars[g]);
+            if (g == 0)
+                tokenCount += tokens.size();
+            long long parseOps = Stats::counter("parse.stack_ops"), treeOps = Stats::counter("tree.stack_ops");
+            accepted[g] = grammars[g]->parse(tokens, input, sink, false);
+            auto begin = std::chrono::steady_clock::now();
+            trees[g] = grammars[g]->buildTree(tokens, input);
+            (g == 0 ? timeBefore : timeAfter) += seconds(begin);
+            ops[0] += Stats::counter("parse.stack_ops") - parseOps;
+            ops[1] += Stats::counter("tree.stack_ops") - treeOps;
+        }
+        if (accepted[0] != accepted[1] || (trees[0] == nullptr) != (trees[1] == nullptr) || accepted[0] != (trees[0] != nullptr)) {
+            std::cout << "  grammar mismatch on \"" << input.substr(0, 40) << "\"\n";
+            Stats::enabled = false;
+            return 1;
+        }
+        if (trees[0] == nullptr)
+            continue;
+        Bytecode::Program before = Bytecode::compile(trees[0].get()), after = Bytecode::compile(trees[1].get());
+        std::vector<double> binding(before.vars.size());
+        for (auto& v : binding)
+            v = dist(rng);
+        std::vector<double> reordered(after.vars.size());
+        for (uint32_t symbol = 0; symbol < after.slots.size(); ++symbol)
+            if (after.slots[symbol] >= 0)
+                reordered[after.slots[symbol]] = binding[before.slot(symbol)];
+        double x = VM(before).run(binding.data()), y = VM(after).run(reordered.data());
+        if (std::memcmp(&x, &y, sizeof(double)) != 0) {
+            std::cout << "  result mismatch on \"" << input.substr(0, 40) << "\"\n";
+            Stats::enabled = false;
+            return 1;
+        }
+    }
+    Stats::enabled = false;
+    std::cout << "stack ops per token (" << tokenCount << " tokens)\n"
+              << "  parse: " << (double)opsBefore[0] / tokenCount << " -> " << (double)opsAfter[0] / tokenCount << "\n"
+              << "  buildTree: " << (double)opsBefore[1] / tokenCount << " -> " << (double)opsAfter[1] / tokenCount
+              << " (" << timeBefore * 1e3 << " ms -> " << timeAfter * 1e3 << " ms)\n";
+    return benchReparse(lexical, optimized);
+}
+
+// 记号流输出：逐行文本(std::endl) 与 二进制格式(writev)，读回后与classify的结果比较
+int benchBinary(const Lexical& lexical) {
+    std::string code = corpus(400000, true);
+    auto expected = classify(lexical.scan(code));
+    const std::string textPath = "/tmp/compilelab_tokens.txt", binaryPath = "/tmp/compilelab_tokens.bin";
+
+    auto begin = std::chrono::steady_clock::now();
+    {
+        std::ofstream out(textPath);
+        for (const auto& t : expected)
+            out << t.first << "\t" << t.second << std::endl;
+    }
+    double textTime = seconds(begin);
+
+    begin = std::chrono::steady_clock::now();
+    int fd = open(binaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    BinaryWriter writer(fd);
+    for (const auto& t : lexical.scanTokens(code)) {
+        std::string kind = kindOf(t.type, code.substr(t.offset, t.length));
+        if (!kind.empty())
+            writer.token(writer.kind(kind), t.offset, t.length);
+    }
+    writer.verdict(true);
+    bool written = writer.finish();
+    close(fd);
+    double binaryTime = seconds(begin);
+
+    std::ifstream in(binaryPath, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BinaryReader reader(data);
+    bool same = written && reader.accepted && reader.tokens.size() == expected.size();
+    for (size_t i = 0; same && i < expected.size(); ++i)
+        same = reader.kind(reader.tokens[i]) == expected[i].first && reader.lexeme(code, reader.tokens[i]) == expected[i].second;
+    std::remove(textPath.c_str());
+    std::remove(binaryPath.c_str());
+    if (!same) {
+        std::cout << "  binary output mismatch\n";
+        return 1;
+    }
+    std::cout << "token output (" << expected.size() << " tokens)\n"
+              << "  text + endl: " << textTime * 1e3 << " ms\n"
+              << "  binary (scan + writev): " << binaryTime * 1e3 << " ms, " << data.size() / 1024 << " KB\n";
+    return 0;
+}
+
+// 标识符驻留：保留下来的内存、名字比较的耗时，多线程共用ConcurrentSymbolTable时编号一致
+int benchSymbols(const Lexical& lexical) {
+    std::mt19937_64 rng(11);
+    std::vector<std::string> names;
+    for (int i = 0; i < 2000; ++i)
+        names.push_back("identifier_" + std::to_string(rng() % 100000) + "_value");
+    std::string code;
+    while (code.size() < (16 << 20))
+        code += names[rng() % names.size()] + (rng() % 4 == 0 ? " + " : " ");
+
+    // 逐个复制词素的记号：vector本身加上超出短字符串优化的堆内存
+    auto strings = lexical.scan(code);
+    size_t stringBytes = strings.capacity() * sizeof(strings[0]);
+    for (const auto& t : strings)
+        stringBytes += t.second.capacity() > 15 ? t.second.capacity() + 1 : 0;
+
+    SymbolTable symbols;
+    internKeywords(symbols);
+    auto begin = std::chrono::steady_clock::now();
+    auto interned = lexical.scanTokens(code, symbols, TokenType::Identifier);
+    double internTime = seconds(begin);
+    size_t internedBytes = interned.capacity() * sizeof(interned[0]) + symbols.memoryBytes();
+
+    std::vector<size_t> ids;
+    for (size_t i = 0; i < interned.size(); ++i)
+        if (interned[i].type == TokenType::Identifier)
+            ids.push_back(i);
+    size_t equalStrings = 0, equalSymbols = 0;
+    begin = std::chrono::steady_clock::now();
+    for (size_t i = 1; i < ids.size(); ++i)
+        equalStrings += strings[ids[i]].second == strings[ids[i - 1]].second;
+    double stringTime = seconds(begin);
+    begin = std::chrono::steady_clock::now();
+    for (size_t i = 1; i < ids.size(); ++i)
+        equalSymbols += interned[ids[i]].symbol == interned[ids[i - 1]].symbol;
+    double symbolTime = seconds(begin);
+    if (equalStrings != equalSymbols) {
+        std::cout << "  symbol comparison mismatch\n";
+        return 1;
+    }
+
+    // 按空格切成块，各线程扫描自己的块，驻留到同一张表
+    unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    ConcurrentSymbolTable shared;
+    internKeywords(shared);
+    std::vector<std::string> chunks(threads);
+    std::vector<std::vector<Lexical::Token>> chunkTokens(threads);
+    size_t from = 0;
+    for (unsigned t = 0; t < threads; ++t) {
+        size_t to = t + 1 == threads ? code.size() : code.find(' ', code.size() * (t + 1) / threads);
+        chunks[t] = code.substr(from, to - from);
+        from = to;
+    }
+    begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]() { chunkTokens[t] = lexical.scanTokens(chunks[t], shared, TokenType::Identifier); });
+    for (auto& w : workers)
+        w.join();
+    double sharedTime = seconds(begin);
+    for (unsigned t = 0; t < threads; ++t)
+        for (const auto& token : chunkTokens[t])
+            if (token.type == TokenType::Identifier &&
+                (shared.name(token.symbol) != chunks[t].substr(token.offset, token.length) || isKeyword(token.symbol))) {
+                std::cout << "  concurrent symbol mismatch\n";
+                return 1;
+            }
+    if (shared.size() != symbols.size()) {
+        std::cout << "  concurrent symbol count mismatch\n";
+        return 1;
+    }
+
+    std::cout << "interning (" << ids.size() << " identifiers, " << symbols.size() - keywords.size() << " distinct)\n"
+              << "  retained: strings " << stringBytes / (1 << 20) << " MB, interned " << internedBytes / (1 << 20) << " MB\n"
+              << "  compare adjacent names: strings " << stringTime * 1e3 << " ms, symbol ids " << symbolTime * 1e3 << " ms\n"
+              << "  scan + intern: 1 thread " << internTime * 1e3 << " ms, " << threads << " threads (shared table) " << sharedTime * 1e3 << " ms\n";
+    return 0;
+}
+
+// 400个随机关键字加标识符和数，DFA的状态表远大于L1
+std::vector<std::pair<std::string, int>> largeSpec() {
+    std::mt19937_64 rng(5);
+    std::vector<std::pair<std::string, int>> spec;
+    for (int i = 0; i < 400; ++i) {
+        std::string word;
+        for (int k = 3 + rng() % 8; k > 0; --k)
+            word += char('a' + rng() % 26);
+        spec.push_back({word, i % 30});
+    }
+    spec.push_back({"[a-z_][a-z_0-9]*", 30});
+    spec.push_back({numberRgex, 31});
+    return spec;
+}
+
+// 几百条规则合并后的词法规格：单线程与多线程构造DFA的耗时，两者的表必须相同
+int benchBuild() {
+    std::vector<std::pair<std::string, int>> spec = largeSpec();
+
+    unsigned long long expected = 0;
+    std::cout << "DFA construction (" << spec.size() << " rules)\n";
+    for (unsigned threads : std::set<unsigned>{1, 2, 4, std::thread::hardware_concurrency()}) {
+        auto begin = std::chrono::steady_clock::now();
+        Lexical lexical(spec, threads);
+        double elapsed = seconds(begin);
+        if (threads == 1)
+            expected = lexical.fingerprint();
+        if (lexical.fingerprint() != expected) {
+            std::cout << "  DFA differs with " << threads << " threads\n";
+            return 1;
+        }
+        std::cout << "  " << threads << " threads: " << elapsed * 1e3 << " ms\n";
+    }
+    return 0;
+}
+
+// 换行符索引：逐字节扫描与SIMD(单线程/多线程)建索引的耗时，按偏移查行列号的耗时，结果与逐字节计数比较
+int benchLineIndex() {
+    std::mt19937_64 rng(13);
+    const std::vector<std::string> pieces = {"x1 + y2", " * (变量 - 3.5)", "\n", "\n    ", "naïve / 2", " ", "\n\n"};
+    std::string code;
+    while (code.size() < (64 << 20))
+        code += pieces[rng() % pieces.size()];
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<size_t> naive;
+    for (size_t i = 0; i < code.size(); ++i)
+        if (code[i] == '\n')
+            naive.push_back(i);
+    double naiveTime = seconds(begin);
+
+    std::cout << "line index (" << code.size() / (1 << 20) << " MB, " << naive.size() + 1 << " lines)\n"
+              << "  byte loop: " << naiveTime * 1e3 << " ms\n";
+    for (unsigned threads : std::set<unsigned>{1, 4, std::thread::hardware_concurrency()}) {
+        begin = std::chrono::steady_clock::now();
+        LineIndex index(code, threads);
+        double elapsed = seconds(begin);
+        if (index.lines() != naive.size() + 1) {
+            std::cout << "  line count mismatch\n";
+            return 1;
+        }
+        std::cout << "  simd, " << threads << " threads: " << elapsed * 1e3 << " ms\n";
+    }
+
+    LineIndex index(code);
+    std::vector<size_t> offsets(1 << 16);
+    for (auto& offset : offsets)
+        offset = rng() % code.size();
+    begin = std::chrono::steady_clock::now();
+    size_t checksum = 0;
+    for (size_t offset : offsets)
+        checksum += index.at(offset).line;
+    double lookupTime = seconds(begin);
+    for (size_t k = 0; k < 64; ++k) {
+        size_t offset = offsets[k];
+        size_t line = std::lower_bound(naive.begin(), naive.end(), offset) - naive.begin();
+        size_t column = 1;
+        for (size_t i = line == 0 ? 0 : naive[line - 1] + 1; i < offset; ++i)
+            column += ((unsigned char)code[i] & 0xC0) != 0x80;
+        LineIndex::Position p = index.at(offset);
+        if (p.line != line + 1 || p.column != column) {
+            std::cout << "  position mismatch at " << offset << "\n";
+            return 1;
+        }
+    }
+    std::cout << "  lookup: " << lookupTime / offsets.size() * 1e9 << " ns per offset (checksum " << checksum << ")\n";
+    return 0;
+}
+
+// L1数据缓存读缺失计数，内核不允许时返回-1
+class CacheMisses {
+   public:
+    CacheMisses() {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~CacheMisses() {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    long long stop() {
+        long long count = -1;
+        if (fd < 0 || ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        return count;
+    }
+
+   private:
+    int fd;
+};
+
+// DFA状态布局：BFS编号+32位状态、BFS编号+窄状态、profile重排+窄状态
+// 用largeSpec的表(远大于L1)，只计时scanTokens，不为每个记号复制词素
+int benchLayout() {
+    std::vector<std::pair<std::string, int>> spec = largeSpec();
+    Lexical lexical(spec);
+    std::mt19937_64 rng(7);
+    const std::vector<std::string> separators = {" ", " ", "\n", "  "};
+    std::string corpus;
+    while (corpus.size() < (8 << 20)) {
+        size_t pick = rng() % (spec.size() + 20);
+        if (pick < spec.size() - 2)
+            corpus += spec[pick].first;
+        else if (pick % 2)
+            corpus += "v" + std::to_string(rng() % 1000);
+        else
+            corpus += std::to_string(rng() % 100) + ".5";
+        corpus += separators[rng() % separators.size()];
+    }
+
+    Lexical::Profile profile = lexical.profile(corpus.substr(0, corpus.size() / 4));
+    struct Layout {
+        const char* name;
+        const Lexical::Profile* profile;
+        bool narrow;
+    };
+    CacheMisses misses;
+    std::cout << "scan (" << corpus.size() / (1 << 20) << " MB, " << spec.size() << " rules, " << lexical.states() << " states)\n";
+    for (auto layout : {Layout{"bfs, int32", nullptr, false}, Layout{"bfs, narrow", nullptr, true}, Layout{"profiled, narrow", &profile, true}}) {
+        lexical.applyProfile(layout.profile, layout.narrow);
+        size_t tokens = 0;
+        misses.start();
+        auto begin = std::chrono::steady_clock::now();
+        for (int r = 0; r < 4; ++r)
+            tokens += lexical.scanTokens(corpus).size();
+        double elapsed = seconds(begin);
+        long long missCount = misses.stop();
+        std::cout << "  " << layout.name << ": " << corpus.size() * 4 / elapsed / (1 << 20) << " MB/s, L1d misses "
+                  << (missCount < 0 ? std::string("n/a") : std::to_string(missCount)) << " (" << tokens / 4 << " tokens)\n";
+    }
+    return 0;
+}
+
+int main() {
+    Lexical lexical = Lexical(rgexList);
+    Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol);
+    if (benchEvaluation(lexical, syntax) != 0)
+        return 1;
+    if (benchReparse(lexical, syntax) != 0 || benchGrammar(lexical, syntax) != 0 || benchBinary(lexical) != 0 ||
+        benchSymbols(lexical) != 0 || benchBuild() != 0 ||
+        benchLineIndex() != 0)
+        return 1;
+    return benchLayout();
+}
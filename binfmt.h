@@ -0,0 +1,293 @@
+#ifndef __BINFMT_H__
+#define __BINFMT_H__
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 记号流与分析结果的二进制格式，整数都是小端
+//
+//   "CLAB" u32版本
+//   若干节: u32标签 u64长度 <内容>，读取时跳过不认识的节
+//     KIND  u32个数，每个种别名为 u32长度 <字节>
+//     TOKN  u32个数，每个记号为 u32种别下标 u32偏移 u32长度，偏移和长度以源码的字节计
+//     VERD  u8 分析成功为1
+//     DIAG  u32条数，每条诊断为 u32长度 <字节>
+//     SYMB  可选，驻留的标识符: u32个数，每个名字为 u32长度 <字节>；
+//           然后u32记号数，每个记号一个u32符号编号，不是标识符的为0xFFFFFFFF
+struct BinaryToken {
+    uint32_t kind;
+    uint32_t offset;
+    uint32_t length;
+};
+
+static_assert(sizeof(BinaryToken) == 12, "BinaryToken must be packed");
+// 读写都直接拷贝内存中的整数，只支持小端主机
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "binfmt assumes a little-endian host");
+
+class BinaryFormat {
+   public:
+    static const uint32_t VERSION = 1;
+    static const uint32_t NO_SYMBOL = UINT32_MAX;
+
+    static uint32_t tag(const char* name) {
+        uint32_t t;
+        std::memcpy(&t, name, 4);
+        return t;
+    }
+};
+
+// 先在内存中积累各节，finish时用一次writev写出：头部和小节在一个缓冲区里，记号数组直接从vector写出
+class BinaryWriter {
+   public:
+    BinaryWriter(int fd) : fd(fd) {
+    }
+
+    // 种别名 -> 下标，首次出现时加入种别表
+    uint32_t kind(const std::string& name) {
+        auto it = kindIndex.find(name);
+        if (it != kindIndex.end())
+            return it->second;
+        uint32_t index = kinds.size();
+        kinds.push_back(name);
+        kindIndex[name] = index;
+        return index;
+    }
+
+    void token(uint32_t kind, uint32_t offset, uint32_t length, uint32_t symbol = BinaryFormat::NO_SYMBOL) {
+        tokens.push_back({kind, offset, length});
+        tokenSymbols.push_back(symbol);
+    }
+
+    // 符号编号 -> 名字，设置后输出SYMB节
+    void symbols(const std::vector<std::string>& names) {
+        symbolNames = names;
+        withSymbols = true;
+    }
+
+    void verdict(bool ok) {
+        accepted = ok;
+    }
+
+    void diagnostic(const std::string& message) {
+        diagnostics.push_back(message);
+    }
+
+    // 写出全部内容，出错时返回false
+    bool finish() {
+        std::string head = "CLAB";
+        put32(head, BinaryFormat::VERSION);
+
+        std::string body;
+        put32(body, kinds.size());
+        for (const auto& k : kinds)
+            putString(body, k);
+        section(head, "KIND", body);
+
+        section(head, "TOKN", 4 + tokens.size() * sizeof(BinaryToken));
+        put32(head, tokens.size());
+
+        std::string tail;
+        section(tail, "VERD", std::string(1, accepted ? 1 : 0));
+        body.clear();
+        put32(body, diagnostics.size());
+        for (const auto& d : diagnostics)
+            putString(body, d);
+        section(tail, "DIAG", body);
+
+        std::string symbolHead;
+        if (withSymbols) {
+            body.clear();
+            put32(body, symbolNames.size());
+            for (const auto& name : symbolNames)
+                putString(body, name);
+            put32(body, tokenSymbols.size());
+            section(symbolHead, "SYMB", body.size() + tokenSymbols.size() * sizeof(uint32_t));
+            symbolHead += body;
+        }
+
+        std::vector<iovec> iov = {{(void*)head.data(), head.size()},
+                                  {(void*)tokens.data(), tokens.size() * sizeof(BinaryToken)},
+                                  {(void*)tail.data(), tail.size()},
+                                  {(void*)symbolHead.data(), symbolHead.size()},
+                                  {(void*)tokenSymbols.data(), withSymbols ? tokenSymbols.size() * sizeof(uint32_t) : 0}};
+        return writeAll(iov);
+    }
+
+   private:
+    int fd;
+    std::vector<std::string> kinds;
+    std::map<std::string, uint32_t> kindIndex;
+    std::vector<BinaryToken> tokens;
+    std::vector<uint32_t> tokenSymbols;
+    bool accepted = false;
+    std::vector<std::string> diagnostics;
+    std::vector<std::string> symbolNames;
+    bool withSymbols = false;  // 符号表为空时也输出SYMB节
+
+    static void put32(std::string& out, uint32_t v) {
+        out.append((const char*)&v, 4);
+    }
+
+    static void put64(std::string& out, uint64_t v) {
+        out.append((const char*)&v, 8);
+    }
+
+    static void putString(std::string& out, const std::string& s) {
+        put32(out, s.size());
+        out += s;
+    }
+
+    static void section(std::string& out, const char* name, uint64_t length) {
+        put32(out, BinaryFormat::tag(name));
+        put64(out, length);
+    }
+
+    static void section(std::string& out, const char* name, const std::string& body) {
+        section(out, name, body.size());
+        out += body;
+    }
+
+    // writev可能只写出一部分，跳过已写的字节继续
+    bool writeAll(std::vector<iovec> iov) {
+        size_t first = 0;
+        while (first < iov.size()) {
+            ssize_t n = writev(fd, iov.data() + first, std::min<size_t>(iov.size() - first, IOV_MAX));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            while (first < iov.size() && (size_t)n >= iov[first].iov_len)
+                n -= iov[first++].iov_len;
+            if (first < iov.size()) {
+                iov[first].iov_base = (char*)iov[first].iov_base + n;
+                iov[first].iov_len -= n;
+            }
+        }
+        return true;
+    }
+};
+
+// 读取BinaryWriter的输出，格式错误时抛出std::runtime_error
+class BinaryReader {
+   public:
+    std::vector<std::string> kinds;
+    std::vector<BinaryToken> tokens;
+    bool accepted = false;
+    std::vector<std::string> diagnostics;
+    std::vector<std::string> symbols;     // 没有SYMB节时为空
+    std::vector<uint32_t> tokenSymbols;  // [记号] -> 符号编号
+
+    BinaryReader(const std::string& input) : data(input.data()), size(input.size()) {
+        if (size < 8 || input.compare(0, 4, "CLAB") != 0)
+            throw std::runtime_error("binfmt: bad magic");
+        pos = 4;
+        if (get32() != BinaryFormat::VERSION)
+            throw std::runtime_error("binfmt: unsupported version");
+        while (pos < size) {
+            uint32_t t = get32();
+            uint64_t length = get64();
+            need(length);
+            size_t end = pos + length;
+            if (t == BinaryFormat::tag("KIND")) {
+                kinds.resize(getCount(4));
+                for (auto& k : kinds)
+                    k = getString();
+            } else if (t == BinaryFormat::tag("TOKN")) {
+                tokens.resize(getCount(sizeof(BinaryToken)));
+                if (!tokens.empty())  // 空vector的data()可能是空指针，不能交给memcpy
+                    std::memcpy(tokens.data(), data + pos, tokens.size() * sizeof(BinaryToken));
+                pos += tokens.size() * sizeof(BinaryToken);
+            } else if (t == BinaryFormat::tag("VERD")) {
+                need(1);
+                accepted = data[pos] != 0;
+                pos++;
+            } else if (t == BinaryFormat::tag("DIAG")) {
+                diagnostics.resize(getCount(4));
+                for (auto& d : diagnostics)
+                    d = getString();
+            } else if (t == BinaryFormat::tag("SYMB")) {
+                symbols.resize(getCount(4));
+                for (auto& name : symbols)
+                    name = getString();
+                tokenSymbols.resize(getCount(sizeof(uint32_t)));
+                if (!tokenSymbols.empty())
+                    std::memcpy(tokenSymbols.data(), data + pos, tokenSymbols.size() * sizeof(uint32_t));
+                pos += tokenSymbols.size() * sizeof(uint32_t);
+            } else {
+                pos = end;
+            }
+            if (pos != end)
+                throw std::runtime_error("binfmt: bad section length");
+        }
+        for (const auto& token : tokens)
+            if (token.kind >= kinds.size())
+                throw std::runtime_error("binfmt: token kind out of range");
+        for (uint32_t symbol : tokenSymbols)
+            if (symbol != BinaryFormat::NO_SYMBOL && symbol >= symbols.size())
+                throw std::runtime_error("binfmt: symbol out of range");
+    }
+
+    const std::string& kind(const BinaryToken& token) const {
+        return kinds[token.kind];
+    }
+
+    // 词素需要原来的源码
+    std::string lexeme(const std::string& source, const BinaryToken& token) const {
+        return source.substr(token.offset, token.length);
+    }
+
+   private:
+    const char* data;  // 只在构造时使用
+    size_t size;
+    size_t pos = 0;
+
+    void need(uint64_t n) const {
+        if (n > size - pos)
+            throw std::runtime_error("binfmt: truncated input");
+    }
+
+    uint32_t get32() {
+        uint32_t v;
+        need(4);
+        std::memcpy(&v, data + pos, 4);
+        pos += 4;
+        return v;
+    }
+
+    uint64_t get64() {
+        uint64_t v;
+        need(8);
+        std::memcpy(&v, data + pos, 8);
+        pos += 8;
+        return v;
+    }
+
+    // 个数后面的每条记录至少recordSize字节(字符串至少有4字节的长度)，先确认剩余字节够用再分配
+    uint32_t getCount(size_t recordSize) {
+        uint32_t n = get32();
+        need((uint64_t)n * recordSize);
+        return n;
+    }
+
+    std::string getString() {
+        uint32_t n = get32();
+        need(n);
+        std::string s(data + pos, n);
+        pos += n;
+        return s;
+    }
+};
+
+const uint32_t BinaryFormat::VERSION;
+const uint32_t BinaryFormat::NO_SYMBOL;
+#endif  // __BINFMT_H__
@@ -0,0 +1,210 @@
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "symbol.h"
+#include "syntax.h"
+
+// 算术表达式的字节码与编译器
+class Bytecode {
+   public:
+    enum OpCode : uint8_t {
+        CONST,  // 压入常量池中的常量
+        LOAD,   // 压入变量槽中的值
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+    };
+
+    struct Instr {
+        OpCode op;
+        uint32_t arg;  // CONST: 常量池下标, LOAD: 变量槽
+    };
+
+    struct Program {
+        std::vector<Instr> code;
+        std::vector<double> consts;     // 常量池
+        std::vector<std::string> vars;  // 变量槽 -> 变量名
+        std::vector<int> slots;         // 符号编号 -> 变量槽，不是变量的为-1
+        size_t maxStack = 0;            // 求值时操作数栈的最大深度
+
+        // 符号编号对应的槽，不是变量返回-1；语法树叶子带符号编号时才能按调用方驻留表里的编号查
+        int slot(uint32_t symbol) const {
+            return symbol < slots.size() ? slots[symbol] : -1;
+        }
+
+        void dump(std::ostream& out) const {
+            static const char* names[] = {"CONST", "LOAD", "ADD", "SUB", "MUL", "DIV"};
+            for (size_t i = 0; i < code.size(); ++i) {
+                out << i << "\t" << names[code[i].op];
+                if (code[i].op == CONST)
+                    out << "\t" << consts[code[i].arg];
+                else if (code[i].op == LOAD)
+                    out << "\t" << vars[code[i].arg];
+                out << "\n";
+            }
+        }
+    };
+
+    // 语法树 -> 字节码，编译期折叠常量子表达式
+    static Program compile(const Syntax::TreeNode* root) {
+        Stats::Scope scope("bytecode.compile");
+        Bytecode compiler;
+        compiler.compileNode(root);
+        compiler.finish();
+        return compiler.program;
+    }
+
+    static double apply(OpCode op, double a, double b) {
+        switch (op) {
+            case ADD:
+                return a + b;
+            case SUB:
+                return a - b;
+            case MUL:
+                return a * b;
+            default:
+                return a / b;
+        }
+    }
+
+   private:
+    Program program;
+    SymbolTable names;  // 叶子没有符号编号时(建树时没给symbols)按名字驻留，编号只在本次编译内有意义
+
+    static bool isOperator(const std::string& symbol) {
+        return symbol == "+" || symbol == "-" || symbol == "*" || symbol == "/";
+    }
+
+    static OpCode opOf(const std::string& symbol) {
+        if (symbol == "+")
+            return ADD;
+        else if (symbol == "-")
+            return SUB;
+        else if (symbol == "*")
+            return MUL;
+        else
+            return DIV;
+    }
+
+    // 运算符作用到已求出的左值上：它后面直到下一个运算符或与结点同名的孩子(嵌套的尾部、长尾链treap的左右子树)
+    // 之前的孩子都是它的操作数，先求操作数再发出运算；同名的孩子按顺序编译，组的顺序就是求值的顺序
+    void compileNode(const Syntax::TreeNode* node) {
+        const auto& children = node->children;
+        if (node->symbol == "num") {
+            emitConst(std::stod(node->lexeme));
+        } else if (node->symbol == "id") {
+            uint32_t symbol = node->id != SymbolTable::NONE ? node->id : names.intern(node->lexeme);
+            auto& slots = program.slots;
+            if (symbol >= slots.size())
+                slots.resize(symbol + 1, -1);
+            if (slots[symbol] < 0) {
+                slots[symbol] = program.vars.size();
+                program.vars.push_back(node->lexeme);
+            }
+            program.code.push_back({LOAD, (uint32_t)slots[symbol]});
+        } else {
+            for (size_t i = 0; i < children.size();) {
+                if (!isOperator(children[i]->symbol)) {
+                    compileNode(children[i++].get());
+                    continue;
+                }
+                OpCode op = opOf(children[i++]->symbol);
+                for (; i < children.size() && !isOperator(children[i]->symbol) && children[i]->symbol != node->symbol; ++i)
+                    compileNode(children[i].get());
+                emitBinary(op);
+            }
+        }
+    }
+
+    void emitConst(double value) {
+        program.code.push_back({CONST, (uint32_t)program.consts.size()});
+        program.consts.push_back(value);
+    }
+
+    // 两个操作数都是常量时直接折叠
+    void emitBinary(OpCode op) {
+        auto& code = program.code;
+        size_t n = code.size();
+        if (n >= 2 && code[n - 1].op == CONST && code[n - 2].op == CONST) {
+            double value = apply(op, program.consts[code[n - 2].arg], program.consts[code[n - 1].arg]);
+            code.pop_back();
+            code.pop_back();
+            emitConst(value);
+        } else {
+            code.push_back({op, 0});
+        }
+    }
+
+    // 压缩常量池并计算最大栈深度
+    void finish() {
+        std::vector<double> consts;
+        size_t depth = 0;
+        for (auto& instr : program.code) {
+            if (instr.op == CONST || instr.op == LOAD) {
+                if (instr.op == CONST) {
+                    consts.push_back(program.consts[instr.arg]);
+                    instr.arg = consts.size() - 1;
+                }
+                if (++depth > program.maxStack)
+                    program.maxStack = depth;
+            } else {
+                depth--;
+            }
+        }
+        program.consts = consts;
+    }
+};
+
+// 栈式虚拟机，操作数栈在构造时一次分配，求值过程不再分配内存
+class VM {
+   public:
+    VM(const Bytecode::Program& program) : program(program), stack(program.maxStack) {
+    }
+
+    // binding[i] 为变量槽i的值
+    double run(const double* binding) {
+        const Bytecode::Instr* pc = program.code.data();
+        const Bytecode::Instr* end = pc + program.code.size();
+        const double* consts = program.consts.data();
+        double* sp = stack.data();
+        for (; pc != end; ++pc) {
+            switch (pc->op) {
+                case Bytecode::CONST:
+                    *sp++ = consts[pc->arg];
+                    break;
+                case Bytecode::LOAD:
+                    *sp++ = binding[pc->arg];
+                    break;
+                case Bytecode::ADD:
+                    sp--;
+                    sp[-1] = sp[-1] + sp[0];
+                    break;
+                case Bytecode::SUB:
+                    sp--;
+                    sp[-1] = sp[-1] - sp[0];
+                    break;
+                case Bytecode::MUL:
+                    sp--;
+                    sp[-1] = sp[-1] * sp[0];
+                    break;
+                case Bytecode::DIV:
+                    sp--;
+                    sp[-1] = sp[-1] / sp[0];
+                    break;
+            }
+        }
+        return stack[0];
+    }
+
+   private:
+    Bytecode::Program program;
+    std::vector<double> stack;
+};
+
+#endif  // __BYTECODE_H__
@@ -0,0 +1,244 @@
+#ifndef __GRAMMAR_H__
+#define __GRAMMAR_H__
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+// 文法变换：在构建分析表之前减少下推自动机的栈操作，接受的语言不变
+// 1. 提取左公因子 A -> a b | a c  =>  A -> a A' , A' -> b | c
+// 2. 只有一个产生式且不递归的非终结符直接代入所有使用处
+// 3. 只被使用一次、且出现在产生式开头的非终结符，把它的各个候选式展开到使用处
+// 4. 单位产生式 A -> B 换成B的各个候选式
+// 2~4对LL(1)文法不改变各产生式的select集，变换后仍是LL(1)文法
+class Grammar {
+   public:
+    typedef std::vector<std::pair<std::string, std::vector<std::string>>> Productions;
+
+    Productions productions;
+    std::set<std::string> terminals;
+    std::set<std::string> nonTerminals;
+    std::string start;
+
+    Grammar(const Productions& prods, const std::set<std::string>& terms,
+            const std::set<std::string>& nonTerms, const std::string& s)
+        : productions(prods), terminals(terms), nonTerminals(nonTerms), start(s) {
+    }
+
+    void optimize() {
+        Stats::Scope scope("grammar.optimize");
+        while (leftFactor())
+            ;
+        while (inlineSingle() || inlineLeading() || eliminateUnit())
+            ;
+        removeUnreachable();
+    }
+
+   private:
+    bool isNonTerminal(const std::string& symbol) const {
+        return nonTerminals.find(symbol) != nonTerminals.end();
+    }
+
+    std::vector<size_t> alternatives(const std::string& nonTerminal) const {
+        std::vector<size_t> result;
+        for (size_t i = 0; i < productions.size(); ++i)
+            if (productions[i].first == nonTerminal)
+                result.push_back(i);
+        return result;
+    }
+
+    // 右部中出现的次数
+    size_t uses(const std::string& nonTerminal) const {
+        size_t n = 0;
+        for (const auto& prod : productions)
+            n += std::count(prod.second.begin(), prod.second.end(), nonTerminal);
+        return n;
+    }
+
+    // 拼接右部，@只在右部为空时出现
+    static std::vector<std::string> concat(const std::vector<std::string>& a, size_t aFrom, size_t aTo,
+                                           const std::vector<std::string>& b) {
+        std::vector<std::string> rhs;
+        for (size_t i = aFrom; i < aTo; ++i)
+            if (a[i] != "@")
+                rhs.push_back(a[i]);
+        for (const auto& symbol : b)
+            if (symbol != "@")
+                rhs.push_back(symbol);
+        return rhs;
+    }
+
+    static std::vector<std::string> orEpsilon(std::vector<std::string> rhs) {
+        if (rhs.empty())
+            rhs.push_back("@");
+        return rhs;
+    }
+
+    // 用replacement替换第at个产生式，并删除重复的产生式，保持原有顺序
+    void replace(const Productions& replacement, size_t at) {
+        Productions next;
+        for (size_t i = 0; i < productions.size(); ++i) {
+            if (i == at)
+                next.insert(next.end(), replacement.begin(), replacement.end());
+            else
+                next.push_back(productions[i]);
+        }
+        std::set<std::pair<std::string, std::vector<std::string>>> seen;
+        productions.clear();
+        for (const auto& prod : next)
+            if (seen.insert(prod).second)
+                productions.push_back(prod);
+    }
+
+    std::string freshName(const std::string& base) const {
+        std::string name = base + "'";
+        while (isNonTerminal(name) || terminals.find(name) != terminals.end())
+            name += "'";
+        return name;
+    }
+
+    // 同一左部中首符号相同的候选式提取最长公共前缀
+    bool leftFactor() {
+        for (const auto& nonTerminal : nonTerminals) {
+            auto alts = alternatives(nonTerminal);
+            for (size_t i = 0; i < alts.size(); ++i) {
+                const auto& first = productions[alts[i]].second;
+                if (first[0] == "@")
+                    continue;
+                std::vector<size_t> group = {alts[i]};
+                for (size_t j = i + 1; j < alts.size(); ++j)
+                    if (productions[alts[j]].second[0] == first[0])
+                        group.push_back(alts[j]);
+                if (group.size() < 2)
+                    continue;
+
+                size_t prefix = first.size();
+                for (size_t k : group) {
+                    const auto& rhs = productions[k].second;
+                    size_t n = 0;
+                    while (n < prefix && n < rhs.size() && rhs[n] == first[n])
+                        n++;
+                    prefix = n;
+                }
+                std::vector<std::string> head(first.begin(), first.begin() + prefix);
+                std::string tail = freshName(nonTerminal);
+                head.push_back(tail);
+
+                Productions next;
+                for (size_t k = 0; k < productions.size(); ++k) {
+                    if (k == group[0]) {
+                        next.push_back({nonTerminal, head});
+                        for (size_t g : group) {
+                            const auto& rhs = productions[g].second;
+                            next.push_back({tail, orEpsilon(std::vector<std::string>(rhs.begin() + prefix, rhs.end()))});
+                        }
+                    } else if (std::find(group.begin(), group.end(), k) == group.end()) {
+                        next.push_back(productions[k]);
+                    }
+                }
+                productions = next;
+                nonTerminals.insert(tail);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // B只有一个产生式且右部不含B：把B代入所有使用处
+    bool inlineSingle() {
+        for (const auto& nonTerminal : nonTerminals) {
+            auto alts = alternatives(nonTerminal);
+            if (nonTerminal == start || alts.size() != 1)
+                continue;
+            std::vector<std::string> rhsB = productions[alts[0]].second;
+            if (std::count(rhsB.begin(), rhsB.end(), nonTerminal) > 0)
+                continue;
+            std::string name = nonTerminal;
+            Productions next;
+            for (size_t i = 0; i < productions.size(); ++i) {
+                if (i == alts[0])
+                    continue;
+                std::vector<std::string> rhs;
+                for (const auto& symbol : productions[i].second) {
+                    if (symbol == name)
+                        rhs.insert(rhs.end(), rhsB.begin(), rhsB.end());
+                    else
+                        rhs.push_back(symbol);
+                }
+                next.push_back({productions[i].first, orEpsilon(concat(rhs, 0, rhs.size(), {}))});
+            }
+            productions = next;
+            nonTerminals.erase(name);
+            return true;
+        }
+        return false;
+    }
+
+    // A -> B b 且B只在这里出现：A -> g1 b | g2 b ...
+    bool inlineLeading() {
+        for (size_t i = 0; i < productions.size(); ++i) {
+            std::string a = productions[i].first;
+            std::vector<std::string> rhs = productions[i].second;
+            std::string b = rhs[0];
+            if (!isNonTerminal(b) || b == a || b == start || uses(b) != 1)
+                continue;
+            Productions expanded;
+            for (size_t k : alternatives(b))
+                expanded.push_back({a, orEpsilon(concat(productions[k].second, 0, productions[k].second.size(),
+                                                        std::vector<std::string>(rhs.begin() + 1, rhs.end())))});
+            replace(expanded, i);
+            productions.erase(std::remove_if(productions.begin(), productions.end(),
+                                             [&](const std::pair<std::string, std::vector<std::string>>& prod) { return prod.first == b; }),
+                              productions.end());
+            nonTerminals.erase(b);
+            return true;
+        }
+        return false;
+    }
+
+    // A -> B：B的候选式中没有单位产生式时，直接换成B的各个候选式
+    bool eliminateUnit() {
+        for (size_t i = 0; i < productions.size(); ++i) {
+            std::string a = productions[i].first;
+            const auto& rhs = productions[i].second;
+            if (rhs.size() != 1 || !isNonTerminal(rhs[0]) || rhs[0] == a)
+                continue;
+            std::string b = rhs[0];
+            Productions expanded;
+            bool unit = false;
+            for (size_t k : alternatives(b)) {
+                const auto& body = productions[k].second;
+                unit = unit || (body.size() == 1 && isNonTerminal(body[0]));
+                expanded.push_back({a, body});
+            }
+            if (unit)
+                continue;
+            replace(expanded, i);
+            return true;
+        }
+        return false;
+    }
+
+    void removeUnreachable() {
+        std::set<std::string> reached = {start};
+        std::vector<std::string> work = {start};
+        while (!work.empty()) {
+            std::string nonTerminal = work.back();
+            work.pop_back();
+            for (const auto& prod : productions)
+                if (prod.first == nonTerminal)
+                    for (const auto& symbol : prod.second)
+                        if (isNonTerminal(symbol) && reached.insert(symbol).second)
+                            work.push_back(symbol);
+        }
+        productions.erase(std::remove_if(productions.begin(), productions.end(),
+                                         [&](const std::pair<std::string, std::vector<std::string>>& prod) { return reached.count(prod.first) == 0; }),
+                          productions.end());
+        nonTerminals = reached;
+    }
+};
+
+#endif  // __GRAMMAR_H__
@@ -0,0 +1,176 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bytecode.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_ENABLED 1
+#endif
+
+// 把字节码翻译成x86-64机器码 (SSE2标量双精度)
+// 操作数栈第i层固定映射到xmm_i，参数rdi为变量绑定数组，结果在xmm0中返回
+class JIT {
+   public:
+    typedef double (*Function)(const double* binding);
+
+    // 不支持的平台或栈深超过16个xmm寄存器时返回nullptr，由调用方退回解释执行
+    static JIT* compile(const Bytecode::Program& program) {
+#ifdef JIT_ENABLED
+        if (program.maxStack > 16 || program.code.empty())
+            return nullptr;
+
+        std::vector<uint8_t> code;
+        std::vector<std::pair<size_t, uint32_t>> constRefs;  // (disp32所在位置, 常量下标)
+        int sp = 0;
+        for (const auto& instr : program.code) {
+            switch (instr.op) {
+                case Bytecode::CONST:
+                    // movsd xmm_sp, [rip + disp32]
+                    emitLoad(code, sp++, 0x05);
+                    constRefs.push_back({code.size(), instr.arg});
+                    emit32(code, 0);
+                    break;
+                case Bytecode::LOAD:
+                    // movsd xmm_sp, [rdi + disp32]
+                    emitLoad(code, sp++, 0x87);
+                    emit32(code, instr.arg * sizeof(double));
+                    break;
+                default:
+                    // addsd/subsd/mulsd/divsd xmm_(sp-2), xmm_(sp-1)
+                    sp--;
+                    emitArith(code, opcode(instr.op), sp - 1, sp);
+                    break;
+            }
+        }
+        code.push_back(0xC3);  // ret
+
+        // 常量池按8字节对齐放在代码之后
+        while (code.size() % sizeof(double) != 0)
+            code.push_back(0xCC);
+        size_t poolOffset = code.size();
+        for (auto ref : constRefs) {
+            int32_t disp = poolOffset + ref.second * sizeof(double) - (ref.first + 4);
+            std::memcpy(&code[ref.first], &disp, 4);
+        }
+        size_t size = poolOffset + program.consts.size() * sizeof(double);
+
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t mapped = (size + page - 1) / page * page;
+        void* mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return nullptr;
+        std::memcpy(mem, code.data(), poolOffset);
+        if (!program.consts.empty())
+            std::memcpy((uint8_t*)mem + poolOffset, program.consts.data(), program.consts.size() * sizeof(double));
+        // 写完后改为只读可执行 (W^X)
+        if (mprotect(mem, mapped, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, mapped);
+            return nullptr;
+        }
+        return new JIT(mem, mapped);
+#else
+        return nullptr;
+#endif
+    }
+
+    ~JIT() {
+#ifdef JIT_ENABLED
+        munmap(mem, size);
+#endif
+    }
+
+    double operator()(const double* binding) const {
+        return function(binding);
+    }
+
+   private:
+    void* mem;
+    size_t size;
+    Function function;
+
+    JIT(void* mem, size_t size) : mem(mem), size(size), function((Function)mem) {
+    }
+
+    JIT(const JIT&) = delete;
+    JIT& operator=(const JIT&) = delete;
+
+    static uint8_t opcode(Bytecode::OpCode op) {
+        switch (op) {
+            case Bytecode::ADD:
+                return 0x58;
+            case Bytecode::SUB:
+                return 0x5C;
+            case Bytecode::MUL:
+                return 0x59;
+            default:
+                return 0x5E;
+        }
+    }
+
+    static void emit32(std::vector<uint8_t>& code, uint32_t value) {
+        for (int i = 0; i < 4; ++i)
+            code.push_back(value >> (i * 8));
+    }
+
+    // movsd xmm_reg, m64；modrm的低位选择寻址方式
+    static void emitLoad(std::vector<uint8_t>& code, int reg, uint8_t modrm) {
+        code.push_back(0xF2);
+        if (reg >= 8)
+            code.push_back(0x44);  // REX.R
+        code.push_back(0x0F);
+        code.push_back(0x10);
+        code.push_back(modrm | ((reg & 7) << 3));
+    }
+
+    static void emitArith(std::vector<uint8_t>& code, uint8_t op, int dst, int src) {
+        code.push_back(0xF2);
+        if (dst >= 8 || src >= 8)
+            code.push_back(0x40 | ((dst >> 3) << 2) | (src >> 3));  // REX.R / REX.B
+        code.push_back(0x0F);
+        code.push_back(op);
+        code.push_back(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+};
+
+// 分层执行：先用VM解释，调用次数达到阈值后编译成机器码
+// JIT不可用时一直解释执行
+class TieredExpr {
+   public:
+    TieredExpr(const Bytecode::Program& program, size_t threshold = 1000)
+        : program(program), vm(program), threshold(threshold) {
+    }
+
+    ~TieredExpr() {
+        delete jit;
+    }
+
+    double run(const double* binding) {
+        if (jit != nullptr)
+            return (*jit)(binding);
+        if (calls < threshold && ++calls == threshold)
+            jit = JIT::compile(program);
+        return vm.run(binding);
+    }
+
+    bool compiled() const {
+        return jit != nullptr;
+    }
+
+   private:
+    Bytecode::Program program;
+    VM vm;
+    JIT* jit = nullptr;
+    size_t calls = 0;
+    size_t threshold;
+
+    TieredExpr(const TieredExpr&) = delete;
+    TieredExpr& operator=(const TieredExpr&) = delete;
+};
+
+#endif  // __JIT_H__
@@ -0,0 +1,134 @@
+#ifndef __LANG_H__
+#define __LANG_H__
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+// 词法规则与文法定义，main与bench共用
+enum TokenType {
+    Number,
+    Identifier,
+    Separator,
+    Operator,
+};
+
+const std::set<std::string> keywords = {
+    "int", "float", "char", "double", "long", "void", "return", "for", "while", "if", "else"};
+
+const std::string numberRgex = "[0-9]*\\.[0-9]+|[0-9]+";
+// 标识符中可以出现的非ASCII码点，按Unicode的XID_Start/XID_Continue取常用文字的区间
+// 不含空白(U+00A0、U+3000)、BOM(U+FEFF)、各种标点与全角标点，这些码点不会并入标识符
+const std::string unicodeIdStart =
+    "\\u{AA}\\u{B5}\\u{BA}\\u{C0-D6}\\u{D8-F6}\\u{F8-2C1}\\u{2C6-2D1}\\u{2E0-2E4}"  // 拉丁字母
+    "\\u{370-373}\\u{376-377}\\u{37B-37D}\\u{386}\\u{388-3F5}\\u{3F7-481}\\u{48A-52F}"  // 希腊、西里尔字母
+    "\\u{531-556}\\u{561-587}\\u{5D0-5EA}\\u{620-64A}\\u{671-6D3}\\u{904-939}\\u{E01-E30}"  // 亚美尼亚、希伯来、阿拉伯、天城、泰文
+    "\\u{10A0-10FF}\\u{1100-11FF}\\u{1E00-1F15}\\u{1F18-1FBC}"                            // 格鲁吉亚、谚文字母、拉丁与希腊扩展
+    "\\u{3041-3096}\\u{30A1-30FA}\\u{3105-312F}\\u{3131-318E}"                              // 假名、注音、谚文兼容字母
+    "\\u{3400-4DBF}\\u{4E00-9FFF}\\u{AC00-D7A3}\\u{F900-FAFF}\\u{20000-2FA1F}"            // 汉字、谚文音节
+    "\\u{FF21-FF3A}\\u{FF41-FF5A}\\u{FF66-FF9D}";                                          // 全角拉丁字母、半角假名
+const std::string unicodeIdContinue =
+    "\\u{B7}\\u{300-36F}\\u{483-487}\\u{591-5BD}\\u{64B-669}\\u{6F0-6F9}\\u{93A-94F}\\u{966-96F}"  // 组合符号、各文字的数字
+    "\\u{E31-E3A}\\u{E47-E4E}\\u{E50-E59}\\u{203F-2040}\\u{20D0-20F0}\\u{3099-309A}"
+    "\\u{FE00-FE0F}\\u{FF10-FF19}\\u{FF3F}";                                                // 变体选择符、全角数字与下划线
+const std::string identifierRgex = "[a-zA-Z_" + unicodeIdStart + "][a-zA-Z_0-9" + unicodeIdStart + unicodeIdContinue + "]*";
+const std::string separatorRgex = "[,;{}\\[\\]()]";
+const std::string operatorRgex = "[-+*/%&|=<>]=?|!=|\\+\\+|--";
+
+const std::vector<std::pair<std::string, int>> rgexList = {
+    {numberRgex, TokenType::Number},
+    {identifierRgex, TokenType::Identifier},
+    {separatorRgex, TokenType::Separator},
+    {operatorRgex, TokenType::Operator}};
+
+// 文法的产生式
+std::vector<std::pair<std::string, std::vector<std::string>>> productions = {
+    {"E", {"T", "E'"}},        // E -> T E'
+    {"E'", {"+", "T", "E'"}},  // E' -> + T E'
+    {"E'", {"-", "T", "E'"}},  // E' -> - T E'
+    {"E'", {"@"}},             // E' -> ε
+    {"T", {"F", "T'"}},        // T -> F T'
+    {"T'", {"*", "F", "T'"}},  // T' -> * F T'
+    {"T'", {"/", "F", "T'"}},  // T' -> / F T'
+    {"T'", {"@"}},             // T' -> ε
+    {"F", {"(", "E", ")"}},    // F -> ( E )
+    {"F", {"num"}},            // F -> num
+    {"F", {"id"}}              // F -> id
+};
+// 终结符集合
+std::set<std::string>
+    terminals = {"+", "-", "*", "/", "(", ")", "num", "id"};
+// 非终结符集合
+std::set<std::string> nonTerminals = {"E", "E'", "T", "T'", "F"};
+// 开始符号
+std::string startSymbol = "E";
+
+// 记号的种别：数字为num，非关键字的标识符为id，关键字、分隔符和运算符就是词素本身
+// 不属于任何规则的记号(空白等)返回空串
+std::string kindOf(int type, const std::string& lexeme) {
+    if (type == TokenType::Number)
+        return "num";
+    else if (type == TokenType::Identifier)
+        return keywords.find(lexeme) != keywords.end() ? lexeme : "id";
+    else if (type == TokenType::Separator || type == TokenType::Operator)
+        return lexeme;
+    return "";
+}
+
+// 驻留表最先放入关键字，关键字的符号编号就是 [0, keywords.size())，判断关键字只需比较编号
+template <typename Symbols>
+void internKeywords(Symbols& symbols) {
+    for (const auto& keyword : keywords)
+        symbols.intern(keyword);
+}
+
+bool isKeyword(uint32_t symbol) {
+    return symbol < keywords.size();
+}
+
+// 细分种别代码，不复制词素：丢掉不属于任何规则的记号，其余记号的type换成种别对应的终结符编号(见Syntax::terminal)
+// 关键字和文法中没有的分隔符、运算符不是终结符，type为Parser::NONE，它们的种别名就是词素本身(见kindName)
+// 标识符已经驻留过时按符号编号判断关键字；只有没驻留的标识符和分隔符、运算符要取出词素，后两者都很短
+template <typename Token, typename Parser>
+std::vector<Token> classifyTokens(const std::vector<Token>& tokens, const std::string& code, const Parser& parser) {
+    Stats::Scope scope("lang.classify");
+    const uint32_t num = parser.terminal("num"), id = parser.terminal("id");
+    std::vector<Token> tokens1;
+    tokens1.reserve(tokens.size());
+    for (Token t : tokens) {
+        uint32_t kind;
+        if (t.type == TokenType::Number)
+            kind = num;
+        else if (t.type == TokenType::Identifier && t.symbol != UINT32_MAX && !isKeyword(t.symbol))
+            kind = id;
+        else if (t.type == TokenType::Identifier || t.type == TokenType::Separator || t.type == TokenType::Operator)
+            kind = parser.terminal(kindOf(t.type, code.substr(t.offset, t.length)));
+        else
+            continue;
+        t.type = kind;
+        tokens1.push_back(t);
+    }
+    return tokens1;
+}
+
+// classifyTokens之后记号的种别名，用于输出
+template <typename Token, typename Parser>
+std::string kindName(const Token& token, const std::string& code, const Parser& parser) {
+    return (uint32_t)token.type != Parser::NONE ? parser.name(token.type) : code.substr(token.offset, token.length);
+}
+
+// 细分种别代码 (int) (float) (void)
+std::vector<std::pair<std::string, std::string>> classify(const std::vector<std::pair<int, std::string>>& tokens) {
+    std::vector<std::pair<std::string, std::string>> tokens1;
+    for (const auto& it : tokens) {
+        std::string kind = kindOf(it.first, it.second);
+        if (!kind.empty())
+            tokens1.push_back({kind, it.second});
+    }
+    return tokens1;
+}
+
+#endif  // __LANG_H__
@@ -1,17 +1,24 @@
 #ifndef __LEXICAL_H__
 #define __LEXICAL_H__
 
-#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <stack>
+#include <thread>
 
 #include "util.h"
 // 词法分析器
 class Lexical {
    private:
+    static const int EPSILON = 256;
+
     struct ID {
         std::set<long long> tokens;
 
@@ -30,7 +37,7 @@ class Lexical {
     class Node {
        public:
         ID id;
-        std::multimap<char, Node*> edges;
+        std::multimap<int, Node*> edges;  // 字节0~255，EPSILON为空边
         bool end;
         int type;
 
@@ -54,115 +61,136 @@ class Lexical {
         NFA(Node* start, Node* end) : start(start), end(end) {
         }
 
-        NFA(char c, int type) : start(nullptr), end(nullptr) {
-            start = new Node(false, type);
-            end = new Node(true, type);
-            start->edges.insert({c, end});
-        }
-
         ~NFA() {
         }
 
        public:
         static NFA* rgexToNFA(const std::string& rgex, int type) {
-            auto tokens = Rgex::toRPN(rgex);
-            for (auto t : tokens)
-                if (!t.op && t.c != '@')
-                    charSet.insert(t.c);
-
-            std::stack<NFA*> nfaStack;
-
-            // 表达式运算
-            for (int i = 0; i < tokens.size(); ++i) {
-                if (tokens[i].op) {
-                    if (tokens[i].c == '|') {
-                        NFA* a = nfaStack.top();
-                        nfaStack.pop();
-                        NFA* b = nfaStack.top();
-                        nfaStack.pop();
-                        nfaStack.push(NFA::nfaOr(a, b));
-
-                        delete a, b;
-                    } else if (tokens[i].c == '.') {
-                        NFA* b = nfaStack.top();
-                        nfaStack.pop();
-                        NFA* a = nfaStack.top();
-                        nfaStack.pop();
-                        nfaStack.push(NFA::nfaDot(a, b));
-
-                        delete a, b;
-                    } else if (tokens[i].c == '*') {
-                        NFA* a = nfaStack.top();
-                        nfaStack.pop();
-                        nfaStack.push(NFA::nfaStar(a));
-
-                        delete a;
-                    } else {
-                    }
-                } else {
-                    nfaStack.push(new NFA(tokens[i].c, type));  // 为单个字符构建NFA，rgex: a ===> S->a
-                }
-            }
-
-            return nfaStack.top();
+            Stats::Scope scope("nfa.rgexToNFA");
+            auto ast = Rgex::parse(rgex);
+            NFA* nfa = compile(ast.get(), type);
+            nfa->end->end = true;
+            return nfa;
         }
 
         static NFA* merge(NFA* a, NFA* b) {
             Node* start = new Node(false, a->start->type | b->start->type);
-            start->edges.insert({'@', a->start});
-            start->edges.insert({'@', b->start});
+            start->edges.insert({EPSILON, a->start});
+            start->edges.insert({EPSILON, b->start});
 
             return new NFA(start, nullptr);
         }
 
        private:
-        static NFA* nfaOr(NFA* a, NFA* b) {
-            a->end->end = false;
-            b->end->end = false;
-
-            // 1. 新建一个初始状态和一个终止状态
-            Node* s1 = new Node(false, a->start->type | b->start->type);
-            Node* s2 = new Node(true, a->end->type | b->end->type);
+        // 语法树直接编译成NFA片段，字节集合只用两个结点和若干条并行边
+        static NFA* compile(const Rgex::Ast* ast, int type) {
+            switch (ast->kind) {
+                case Rgex::Ast::BYTES: {
+                    NFA* nfa = fragment(type);
+                    for (int b = 0; b < 256; ++b)
+                        if (ast->bytes[b])
+                            nfa->start->edges.insert({b, nfa->end});
+                    return nfa;
+                }
+                case Rgex::Ast::CONCAT: {
+                    NFA* nfa = compile(ast->children[0].get(), type);
+                    for (size_t i = 1; i < ast->children.size(); ++i) {
+                        NFA* next = compile(ast->children[i].get(), type);
+                        NFA* joined = nfaDot(nfa, next);
+                        delete nfa;
+                        delete next;
+                        nfa = joined;
+                    }
+                    return nfa;
+                }
+                case Rgex::Ast::ALT: {
+                    // 多个分支共用一个初始状态和一个终止状态
+                    NFA* nfa = fragment(type);
+                    for (const auto& child : ast->children) {
+                        NFA* branch = compile(child.get(), type);
+                        nfa->start->edges.insert({EPSILON, branch->start});
+                        branch->end->edges.insert({EPSILON, nfa->end});
+                        delete branch;
+                    }
+                    return nfa;
+                }
+                case Rgex::Ast::REPEAT:
+                    return repeat(ast->children[0].get(), ast->min, ast->max, type);
+                default: {
+                    NFA* nfa = fragment(type);
+                    nfa->start->edges.insert({EPSILON, nfa->end});
+                    return nfa;
+                }
+            }
+        }
 
-            // 2. 将s1用空边指向 a.start, b.start
-            s1->edges.insert({'@', a->start});
-            s1->edges.insert({'@', b->start});
+        // a{min,max}：先连接min份a，再接 a* 或 (max-min) 份可选的a
+        static NFA* repeat(const Rgex::Ast* a, int min, int max, int type) {
+            NFA* nfa = fragment(type);
+            nfa->start->edges.insert({EPSILON, nfa->end});
+            for (int i = 0; i < min; ++i) {
+                NFA* next = compile(a, type);
+                NFA* joined = nfaDot(nfa, next);
+                delete nfa;
+                delete next;
+                nfa = joined;
+            }
 
-            // 3. 将 a.end, b.end 用空边指向s2
-            a->end->edges.insert({'@', s2});
-            b->end->edges.insert({'@', s2});
+            NFA* tail = nullptr;
+            if (max == -1) {
+                tail = nfaStar(compile(a, type));
+            } else if (max > min) {
+                tail = fragment(type);
+                tail->start->edges.insert({EPSILON, tail->end});
+                for (int i = min; i < max; ++i) {
+                    NFA* next = nfaOptional(compile(a, type));
+                    NFA* joined = nfaDot(tail, next);
+                    delete tail;
+                    delete next;
+                    tail = joined;
+                }
+            }
+            if (tail != nullptr) {
+                NFA* joined = nfaDot(nfa, tail);
+                delete nfa;
+                delete tail;
+                nfa = joined;
+            }
+            return nfa;
+        }
 
-            return new NFA(s1, s2);
+        static NFA* fragment(int type) {
+            return new NFA(new Node(false, type), new Node(false, type));
         }
 
         static NFA* nfaStar(NFA* a) {
-            a->end->end = false;
-
             // 1. 新建一个初始状态s1和一个终止状态s2
             Node* s1 = new Node(false, a->end->type);
-            Node* s2 = new Node(true, a->end->type);
+            Node* s2 = new Node(false, a->end->type);
 
             // 2. 让s1用空边指向a.start，s2
-            s1->edges.insert({'@', a->start});
-            s1->edges.insert({'@', s2});
+            s1->edges.insert({EPSILON, a->start});
+            s1->edges.insert({EPSILON, s2});
 
             // 3. 让a.end用空边指向s2, a.start
-            a->end->edges.insert({'@', s2});
-            a->end->edges.insert({'@', a->start});
+            a->end->edges.insert({EPSILON, s2});
+            a->end->edges.insert({EPSILON, a->start});
 
+            delete a;
             return new NFA(s1, s2);
         }
 
+        static NFA* nfaOptional(NFA* a) {
+            a->start->edges.insert({EPSILON, a->end});
+            return a;
+        }
+
         static NFA* nfaDot(NFA* a, NFA* b) {
             // 1. 用空边将a的终结状态和b的初始状态连接
-            a->end->end = false;
-            a->end->edges.insert({'@', b->start});
+            a->end->edges.insert({EPSILON, b->start});
 
             return new NFA(a->start, b->end);
         }
-
-       public:
-        static std::set<char> charSet;  // 非终结符集
     };
 
     class DFA {
@@ -179,7 +207,14 @@ class Lexical {
         }
 
        public:
-        static DFA* NFAtoDFA(NFA* nfa) {
+        // threads > 1 时按层并行展开子集，见NFAtoDFAParallel
+        static DFA* NFAtoDFA(NFA* nfa, unsigned threads = 1) {
+            if (threads == 0)
+                threads = 1;
+            if (threads > 1)
+                return NFAtoDFAParallel(nfa, threads);
+            Stats::Scope scope("dfa.NFAtoDFA");
+            long long explored = 0;
             std::queue<std::set<Node*>> workList;
             std::set<std::set<Node*>> visited;
             std::map<ID, Node*> dfaNodes;
@@ -195,24 +230,29 @@ class Lexical {
                 workList.pop();
                 if (visited.find(currentSet) != visited.end()) continue;
                 visited.insert(currentSet);
+                explored++;
 
-                for (char c : NFA::charSet) {
+                Node* from = dfaNodes[createStateId(currentSet)];
+                // 同一字节区间里的字符move结果相同，只求一次闭包
+                std::map<std::set<Node*>, Node*> targets;
+                for (const auto& step : moves(currentSet)) {
                     // 1. 去除空边，构建子集
-                    std::set<Node*> nextSet = epsilonClosure(move(currentSet, c));
-                    if (nextSet.empty()) continue;
-                    if (visited.find(nextSet) == visited.end())
-                        workList.push(nextSet);
-
-                    ID fromId = createStateId(currentSet);
-                    ID toId = createStateId(nextSet);
-
-                    Node* from = dfaNodes[fromId];
-                    Node* to = nullptr;
-                    if (dfaNodes.find(toId) == dfaNodes.end()) {
-                        to = new Node(toId, containsFinalState(nextSet), calueType(nextSet));
-                        dfaNodes.insert({toId, to});
-                    } else {
-                        to = dfaNodes[toId];
+                    int c = step.first;
+                    const std::set<Node*>& moved = step.second;
+                    Node*& to = targets[moved];
+                    if (to == nullptr) {
+                        std::set<Node*> nextSet = epsilonClosure(moved);
+                        if (visited.find(nextSet) == visited.end())
+                            workList.push(nextSet);
+
+                        ID toId = createStateId(nextSet);
+                        auto it = dfaNodes.find(toId);
+                        if (it == dfaNodes.end()) {
+                            to = new Node(toId, containsFinalState(nextSet), calueType(nextSet));
+                            dfaNodes.insert({toId, to});
+                        } else {
+                            to = it->second;
+                        }
                     }
 
                     // 2. 添加一条DFA的边(from->to)
@@ -220,90 +260,186 @@ class Lexical {
                 }
             }
 
+            Stats::count("dfa.subsets_explored", explored);
+            Stats::count("dfa.states", dfaNodes.size());
+
             DFA* dfa = new DFA(startNode);
-            simplify(dfa);
+            simplify(dfa, threads);
             return dfa;
         }
 
        private:
-        static void simplify(DFA* dfa) {
-            std::set<Node*> terminationSet;
-            std::set<Node*> nonTerminalSet;
-            std::set<Node*> visited;
-            std::stack<Node*> stack;
-
-            stack.push(dfa->start);
-
-            while (!stack.empty()) {
-                Node* n = stack.top();
-                stack.pop();
-                visited.insert(n);
+        // 多线程共用的 子集ID -> DFA状态 表，按ID的哈希分片加锁
+        class StateTable {
+           public:
+            // 返回子集对应的状态，second为true表示由这次调用新建
+            std::pair<Node*, bool> intern(const std::set<Node*>& subset) {
+                ID id = createStateId(subset);
+                unsigned long long h = 1469598103934665603ULL;  // FNV-1a
+                for (long long token : id.tokens)
+                    h = (h ^ (unsigned long long)token) * 1099511628211ULL;
+                Shard& shard = shards[h % SHARDS];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto it = shard.states.find(id);
+                if (it != shard.states.end())
+                    return {it->second, false};
+                Node* node = new Node(id, containsFinalState(subset), calueType(subset));
+                shard.states.insert({id, node});
+                return {node, true};
+            }
 
-                if (n->end)
-                    terminationSet.insert(n);
-                else
-                    nonTerminalSet.insert(n);
-                for (auto e : n->edges)
-                    if (visited.find(e.second) == visited.end())
-                        stack.push(e.second);
+            size_t size() {
+                size_t n = 0;
+                for (auto& shard : shards) {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    n += shard.states.size();
+                }
+                return n;
             }
 
-            std::queue<std::set<Node*>> workList;
-            workList.push(terminationSet);
-            workList.push(nonTerminalSet);
-
-            bool done = false;
-            while (!done) {
-                done = true;
-                int n = workList.size();
-                while (n-- > 0) {
-                    auto set = workList.front();
-                    auto newSet = std::set<Node*>();
-                    Node* first = *(set.begin());
-                    for (auto b : set)
-                        if (!equivalent(first, b, workList))
-                            newSet.insert(b);
-
-                    if (newSet.size() > 0) {
-                        for (auto n : newSet)
-                            set.erase(n);
-                        workList.push(newSet);
-                        done = false;
+           private:
+            static const size_t SHARDS = 64;
+
+            struct Shard {
+                std::mutex mutex;
+                std::map<ID, Node*> states;
+            };
+            Shard shards[SHARDS];
+        };
+
+        // 按层同步的并行子集构造：同一层的子集分给各线程展开，新发现的子集组成下一层
+        // 每个DFA状态只由展开它的线程添加出边；新子集只在StateTable中登记一次，由发现它的线程放入下一层
+        // 下一层按子集ID排序，展开顺序与线程调度无关；最终编号由flatten按广度优先重新给出，与串行版本一致
+        static DFA* NFAtoDFAParallel(NFA* nfa, unsigned threads) {
+            Stats::Scope scope("dfa.NFAtoDFA");
+            StateTable states;
+            std::set<Node*> startSet = epsilonClosure({nfa->start});
+            Node* startNode = states.intern(startSet).first;
+
+            typedef std::pair<std::set<Node*>, Node*> Item;
+            std::vector<Item> frontier = {{startSet, startNode}};
+            long long explored = 0;
+            while (!frontier.empty()) {
+                explored += frontier.size();
+                std::vector<std::vector<Item>> found(threads);
+                std::atomic<size_t> cursor(0);
+                auto expand = [&](unsigned t) {
+                    for (size_t i = cursor++; i < frontier.size(); i = cursor++) {
+                        const std::set<Node*>& currentSet = frontier[i].first;
+                        Node* from = frontier[i].second;
+                        std::map<std::set<Node*>, Node*> targets;
+                        for (const auto& step : moves(currentSet)) {
+                            int c = step.first;
+                            const std::set<Node*>& moved = step.second;
+                            Node*& to = targets[moved];
+                            if (to == nullptr) {
+                                std::set<Node*> nextSet = epsilonClosure(moved);
+                                auto interned = states.intern(nextSet);
+                                to = interned.first;
+                                if (interned.second)
+                                    found[t].push_back({nextSet, to});
+                            }
+                            from->edges.insert({c, to});
+                        }
                     }
-                    workList.pop();
-                    workList.push(set);
+                };
+                std::vector<std::thread> workers;
+                for (unsigned t = 1; t < threads; ++t)
+                    workers.emplace_back(expand, t);
+                expand(0);
+                for (auto& w : workers)
+                    w.join();
+
+                frontier.clear();
+                for (auto& items : found)
+                    frontier.insert(frontier.end(), items.begin(), items.end());
+                std::sort(frontier.begin(), frontier.end(), [](const Item& a, const Item& b) { return a.second->id < b.second->id; });
+            }
+
+            Stats::count("dfa.subsets_explored", explored);
+            Stats::count("dfa.states", states.size());
+
+            DFA* dfa = new DFA(startNode);
+            simplify(dfa, threads);
+            return dfa;
+        }
+
+        // 最小化 (Moore算法)：先按是否接受和接受的type划分，再按 (所在类, 每条出边的(字节, 目标所在类)) 反复细分，
+        // 直到类的个数不再变化；每个类保留按广度优先最先遇到的状态，其余状态删除，指向它们的边改指向保留的状态
+        // 每轮各状态的签名互不依赖，threads > 1 时分段并行计算；类按状态顺序编号，结果与线程数无关
+        static void simplify(DFA* dfa, unsigned threads) {
+            Stats::Scope scope("dfa.simplify");
+            std::vector<Node*> states = {dfa->start};
+            std::map<Node*, int> index = {{dfa->start, 0}};
+            for (size_t s = 0; s < states.size(); ++s)
+                for (auto e : states[s]->edges)
+                    if (index.insert({e.second, (int)states.size()}).second)
+                        states.push_back(e.second);
+            size_t n = states.size();
+
+            std::vector<std::vector<int>> targets(n);  // [状态] -> 出边 (字节, 目标状态) 展平
+            for (size_t s = 0; s < n; ++s)
+                for (auto e : states[s]->edges) {
+                    targets[s].push_back(e.first);
+                    targets[s].push_back(index[e.second]);
                 }
+
+            std::vector<int> cls(n);
+            size_t classes = assign(n, cls, [&](size_t s) { return std::vector<int>{states[s]->end, states[s]->end ? states[s]->type : 0}; });
+            std::vector<std::vector<int>> signatures(n);
+            long long rounds = 0;
+            while (true) {
+                rounds++;
+                auto sign = [&](size_t begin, size_t end) {
+                    for (size_t s = begin; s < end; ++s) {
+                        auto& sig = signatures[s];
+                        sig.assign(1, cls[s]);
+                        for (size_t k = 0; k < targets[s].size(); k += 2) {
+                            sig.push_back(targets[s][k]);
+                            sig.push_back(cls[targets[s][k + 1]]);
+                        }
+                    }
+                };
+                std::vector<std::thread> workers;
+                size_t chunk = (n + threads - 1) / threads;
+                for (size_t begin = chunk; threads > 1 && begin < n; begin += chunk)
+                    workers.emplace_back(sign, begin, std::min(n, begin + chunk));
+                sign(0, std::min(n, chunk));
+                for (auto& w : workers)
+                    w.join();
+
+                size_t refined = assign(n, cls, [&](size_t s) { return signatures[s]; });
+                if (refined == classes)
+                    break;
+                classes = refined;
             }
 
-            // 根据集合重构dfa
-        }
-
-        // 状态a和状态b是否等价
-        static bool equivalent(Node* a, Node* b, std::queue<std::set<Node*>>& simplifiedSet) {
-            // a和b的每条边都指向同一个集合里的元素
-            for (auto c : NFA::charSet) {
-                Node* aNext = nullptr;
-                Node* bNext = nullptr;
-                auto it = a->edges.find(c);
-                if (it != a->edges.end())
-                    aNext = (*it).second;
-                it = b->edges.find(c);
-                if (it != b->edges.end())
-                    bNext = (*it).second;
-
-                int n = simplifiedSet.size();
-                while (n > 0) {
-                    auto set = simplifiedSet.front();
-                    simplifiedSet.pop();
-                    bool c = set.find(aNext) == set.end();
-                    bool d = set.find(bNext) == set.end();
-                    if (c ^ d)
-                        return false;
-                    n--;
-                    simplifiedSet.push(set);
+            std::vector<Node*> keep(classes, nullptr);
+            for (size_t s = 0; s < n; ++s)
+                if (keep[cls[s]] == nullptr)
+                    keep[cls[s]] = states[s];
+            for (size_t s = 0; s < n; ++s) {
+                if (keep[cls[s]] != states[s]) {
+                    delete states[s];
+                    continue;
                 }
+                std::multimap<int, Node*> edges;
+                for (size_t k = 0; k < targets[s].size(); k += 2)
+                    edges.insert({targets[s][k], keep[cls[targets[s][k + 1]]]});
+                states[s]->edges = edges;
             }
-            return true;
+            dfa->start = keep[cls[0]];
+            Stats::count("dfa.minimized_states", classes);
+            Stats::count("dfa.minimize_rounds", rounds);
+        }
+
+        // 按签名给状态分类，类按第一次出现的状态顺序编号，返回类的个数
+        template <typename Signature>
+        static size_t assign(size_t n, std::vector<int>& cls, Signature signature) {
+            std::map<std::vector<int>, int> ids;
+            for (size_t s = 0; s < n; ++s)
+                cls[s] = ids.insert({signature(s), (int)ids.size()}).first->second;
+            return ids.size();
         }
 
         static std::set<Node*> epsilonClosure(const std::set<Node*>& inputSet) {
@@ -318,7 +454,7 @@ class Lexical {
                 stack.pop();
                 resultSet.insert(current);
 
-                auto range = current->edges.equal_range('@');
+                auto range = current->edges.equal_range(EPSILON);
                 for (auto it = range.first; it != range.second; it++) {
                     Node* n = (*it).second;
                     if (resultSet.find(n) == resultSet.end())
@@ -328,22 +464,23 @@ class Lexical {
             return resultSet;
         }
 
+        // 集合读入每个字符后到达的结点 (不含空边)，遍历一遍出边得到全部字符的move结果
+        // 字母表按字节展开后很大，只出现实际有出边的字符
+        static std::map<int, std::set<Node*>> moves(const std::set<Node*>& stateSet) {
+            std::map<int, std::set<Node*>> result;
+            for (auto node : stateSet)
+                for (auto e : node->edges)
+                    if (e.first != EPSILON)
+                        result[e.first].insert(e.second);
+            return result;
+        }
+
         static bool containsFinalState(const std::set<Node*>& stateSet) {
             for (Node* node : stateSet)
                 if (node->end) return true;
             return false;
         }
 
-        static std::set<Node*> move(const std::set<Node*>& inputSet, char input) {
-            std::set<Node*> resultSet;
-            for (auto node : inputSet) {
-                auto range = node->edges.equal_range(input);
-                for (auto it = range.first; it != range.second; ++it)
-                    resultSet.insert((*it).second);
-            }
-            return resultSet;
-        }
-
         static ID createStateId(const std::set<Node*>& stateSet) {
             std::set<long long> ids;
             for (auto node : stateSet)
@@ -364,10 +501,155 @@ class Lexical {
     DFA* dfa = nullptr;
     NFA* nfa = nullptr;
 
+    // 展开后的DFA：状态s读入字节b后转到 table[s * 256 + b]，-1表示无转移
+    // 状态按NFAtoDFA之后广度优先的顺序编号，profile也以这个编号记录
+    std::vector<int> table;
+    std::vector<int> accept;  // 终态的type，非终态为0
+
+    // 扫描实际使用的表：按profile重新编号，热的状态行排在最前面
+    // 状态少时用更窄的整数存状态编号，该类型的最大值表示无转移
+    // 扫描时每个字节只查一次表，UTF-8多字节字符按字节逐个转移
+    std::vector<uint8_t> packed8;
+    std::vector<uint16_t> packed16;
+    std::vector<int32_t> packed32;
+    std::vector<int> packedAccept;
+    int packedWidth = 0;
+
+    void flatten() {
+        std::map<Node*, int> index;
+        std::vector<Node*> states;
+        index[dfa->start] = 0;
+        states.push_back(dfa->start);
+        for (size_t s = 0; s < states.size(); ++s) {
+            for (auto e : states[s]->edges) {
+                if (index.find(e.second) == index.end()) {
+                    index[e.second] = states.size();
+                    states.push_back(e.second);
+                }
+            }
+        }
+
+        table.assign(states.size() * 256, -1);
+        accept.assign(states.size(), 0);
+        for (size_t s = 0; s < states.size(); ++s) {
+            for (auto e : states[s]->edges)
+                table[s * 256 + e.first] = index[e.second];
+            if (states[s]->end)
+                accept[s] = states[s]->type;
+        }
+    }
+
+    // 按order给出的顺序重新编号(order[新编号] = 旧编号)并压缩状态编号的宽度
+    void pack(const std::vector<int>& order, bool narrow) {
+        size_t n = accept.size();
+        std::vector<int> rank(n);
+        for (size_t i = 0; i < n; ++i)
+            rank[order[i]] = i;
+
+        packedWidth = !narrow ? 32 : n < 0xFF ? 8 : n < 0xFFFF ? 16 : 32;
+        packed8.clear();
+        packed16.clear();
+        packed32.clear();
+        packedAccept.assign(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            packedAccept[i] = accept[order[i]];
+            for (int b = 0; b < 256; ++b) {
+                int to = table[order[i] * 256 + b];
+                int32_t next = to < 0 ? -1 : rank[to];
+                if (packedWidth == 8)
+                    packed8.push_back(next);
+                else if (packedWidth == 16)
+                    packed16.push_back(next);
+                else
+                    packed32.push_back(next);
+            }
+        }
+    }
+
+    // 每识别出一个记号调用一次emit(type, offset, length)
+    template <typename T, typename Emit>
+    void scanPacked(const std::vector<T>& packed, const std::string& code, Emit emit) const {
+        const T dead = (T)-1;
+        const T* next = packed.data();
+        const int* acc = packedAccept.data();
+        size_t pos = 0;
+        while (pos < code.size()) {
+            size_t s = 0;
+            size_t startPos = pos;
+            int type = 0;
+            for (size_t i = pos; i < code.size(); ++i) {
+                T t = next[s * 256 + (unsigned char)code[i]];
+                if (t == dead)
+                    break;
+                s = t;
+                if (acc[s] != 0) {
+                    pos = i;
+                    type = acc[s];
+                }
+            }
+            // 没有规则匹配时该字节单独成为type为-1的记号
+            emit(type == 0 ? -1 : __builtin_ctz(type), startPos, ++pos - startPos);
+        }
+    }
+
    public:
-    Lexical(std::vector<std::pair<std::string, int>> rgexList) : dfa(nullptr) {
+    // 记号在源码中的位置，不复制词素
+    struct Token {
+        int type;
+        uint32_t offset;
+        uint32_t length;
+        uint32_t symbol = UINT32_MAX;  // 驻留后的符号编号，只有驻留的记号才有
+    };
+
+    // 训练语料上每个状态、每条转移被走过的次数，按BFS编号记录
+    struct Profile {
+        unsigned long long fingerprint = 0;     // 对应DFA的指纹，DFA变了之后旧profile不再适用
+        std::vector<long long> stateHits;       // [状态]
+        std::vector<long long> transitionHits;  // [状态 * 256 + 字节]
+
+        bool save(const std::string& path) const {
+            std::ofstream out(path);
+            out << "lexprofile " << fingerprint << " " << stateHits.size() << "\n";
+            for (size_t s = 0; s < stateHits.size(); ++s)
+                if (stateHits[s] != 0)
+                    out << "s " << s << " " << stateHits[s] << "\n";
+            for (size_t i = 0; i < transitionHits.size(); ++i)
+                if (transitionHits[i] != 0)
+                    out << "t " << i / 256 << " " << i % 256 << " " << transitionHits[i] << "\n";
+            return (bool)out;
+        }
+
+        // 状态数超过maxStates(一般传入当前DFA的状态数)时不读，避免按文件里的数字分配过大的表
+        bool load(const std::string& path, size_t maxStates) {
+            std::ifstream in(path);
+            std::string magic;
+            size_t states = 0;
+            if (!(in >> magic >> fingerprint >> states) || magic != "lexprofile" || states > maxStates)
+                return false;
+            stateHits.assign(states, 0);
+            transitionHits.assign(states * 256, 0);
+            std::string kind;
+            size_t s, b;
+            long long hits;
+            while (in >> kind >> s) {
+                if (s >= states)
+                    return false;
+                if (kind == "s" && in >> hits)
+                    stateHits[s] = hits;
+                else if (kind == "t" && in >> b >> hits && b < 256)
+                    transitionHits[s * 256 + b] = hits;
+                else
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    // threads > 1 时并行构造DFA，结果与单线程相同
+    Lexical(std::vector<std::pair<std::string, int>> rgexList, unsigned threads = 1) : dfa(nullptr) {
         if (rgexList.size() == 0)
             exit(1);
+        long long nodeCount = Node::NODE_COUNT;
         nfa = NFA::rgexToNFA(rgexList[0].first, 1 << rgexList[0].second);
         if (rgexList[0].second >= 32 || rgexList[0].second < 0)
             exit(1);
@@ -381,67 +663,138 @@ class Lexical {
             nfa = merged;
         }
 
-        dfa = DFA::NFAtoDFA(nfa);
+        Stats::count("nfa.states", Node::NODE_COUNT - nodeCount);
+
+        dfa = DFA::NFAtoDFA(nfa, threads);
+        flatten();
+        applyProfile(nullptr);
     }
 
     ~Lexical() {
         if (dfa != nullptr) {
-            std::stack<Node*> stack;
-            std::set<Node*> visited;
-            stack.push(dfa->start);
-            while (!stack.empty()) {
-                Node* n = stack.top();
-                stack.pop();
-                visited.insert(n);
-                for (auto e : n->edges)
-                    if (visited.find(e.second) != visited.end())
-                        stack.push(e.second);
-                delete n;
-            }
+            freeGraph(dfa->start);
             delete dfa;
         }
-
         if (nfa != nullptr) {
-            std::stack<Node*> stack;
-            std::set<Node*> visited;
-            stack.push(nfa->start);
-            while (!stack.empty()) {
-                Node* n = stack.top();
-                stack.pop();
-                visited.insert(n);
-                for (auto e : n->edges)
-                    if (visited.find(e.second) != visited.end())
-                        stack.push(e.second);
-                delete n;
-            }
+            freeGraph(nfa->start);
             delete nfa;
         }
     }
 
-    std::vector<std::pair<int, std::string>> scan(const std::string& code) {
-        std::vector<std::pair<int, std::string>> tokens;
+    size_t states() const {
+        return accept.size();
+    }
+
+    unsigned long long fingerprint() const {
+        unsigned long long h = 1469598103934665603ULL;  // FNV-1a
+        for (int v : table)
+            h = (h ^ (unsigned)v) * 1099511628211ULL;
+        for (int v : accept)
+            h = (h ^ (unsigned)v) * 1099511628211ULL;
+        return h;
+    }
+
+    // 用和scan相同的最长匹配规则扫描训练语料，统计状态与转移的命中次数
+    Profile profile(const std::string& corpus) const {
+        Profile p;
+        p.fingerprint = fingerprint();
+        p.stateHits.assign(accept.size(), 0);
+        p.transitionHits.assign(table.size(), 0);
         size_t pos = 0;
-        while (pos < code.size()) {
-            Node* n = dfa->start;
-            size_t startPos = pos;
-            int type = 0;
-            for (size_t i = pos; i < code.size(); ++i) {
-                char c = code[i];
-                auto it = n->edges.find(c);
-                if (it == n->edges.end()) {
+        while (pos < corpus.size()) {
+            int s = 0;
+            p.stateHits[0]++;
+            for (size_t i = pos; i < corpus.size(); ++i) {
+                int from = s;
+                s = table[s * 256 + (unsigned char)corpus[i]];
+                if (s < 0)
                     break;
-                } else if ((*it).second->end) {
+                p.transitionHits[from * 256 + (unsigned char)corpus[i]]++;
+                p.stateHits[s]++;
+                if (accept[s] != 0)
                     pos = i;
-                    type = (*it).second->type;
-                }
-                n = (*it).second;
             }
-            tokens.push_back({log(type & -type) / log(2), code.substr(startPos, ++pos - startPos)});
+            ++pos;
+        }
+        return p;
+    }
+
+    // 按命中次数从高到低重新编号(开始状态固定为0)；profile为nullptr时恢复BFS编号
+    // narrow为false时总是用32位状态编号，便于对比
+    // profile与当前DFA不匹配时返回false，保持原来的布局
+    bool applyProfile(const Profile* profile, bool narrow = true) {
+        std::vector<int> order(accept.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        if (profile != nullptr) {
+            if (profile->fingerprint != fingerprint() || profile->stateHits.size() != accept.size())
+                return false;
+            const auto& hits = profile->stateHits;
+            std::stable_sort(order.begin() + 1, order.end(), [&](int a, int b) { return hits[a] > hits[b]; });
         }
+        pack(order, narrow);
+        return true;
+    }
+
+    std::vector<std::pair<int, std::string>> scan(const std::string& code) const {
+        Stats::Scope scope("lexical.scan");
+        std::vector<std::pair<int, std::string>> tokens;
+        scanWith(code, [&](int type, size_t offset, size_t length) { tokens.push_back({type, code.substr(offset, length)}); });
+        Stats::count("lexical.bytes", code.size());
+        Stats::count("lexical.tokens", tokens.size());
+        return tokens;
+    }
+
+    // 与scan相同，但只记录位置和长度；源码不能超过4GB
+    std::vector<Token> scanTokens(const std::string& code) const {
+        Stats::Scope scope("lexical.scanTokens");
+        std::vector<Token> tokens;
+        scanWith(code, [&](int type, size_t offset, size_t length) { tokens.push_back({type, (uint32_t)offset, (uint32_t)length}); });
+        Stats::count("lexical.bytes", code.size());
+        Stats::count("lexical.tokens", tokens.size());
         return tokens;
     }
+
+    // 扫描的同时把internType类的记号驻留到symbols中(SymbolTable或ConcurrentSymbolTable，见symbol.h)
+    // 记号识别出来时词素还在缓存里，紧接着算哈希并查表
+    template <typename Symbols>
+    std::vector<Token> scanTokens(const std::string& code, Symbols& symbols, int internType) const {
+        Stats::Scope scope("lexical.scanTokens");
+        std::vector<Token> tokens;
+        scanWith(code, [&](int type, size_t offset, size_t length) {
+            tokens.push_back({type, (uint32_t)offset, (uint32_t)length});
+            if (type == internType)
+                tokens.back().symbol = symbols.intern(code.data() + offset, length);
+        });
+        Stats::count("lexical.bytes", code.size());
+        Stats::count("lexical.tokens", tokens.size());
+        return tokens;
+    }
+
+   private:
+    // 图中有环，先找出全部可达结点再逐个释放
+    static void freeGraph(Node* start) {
+        std::vector<Node*> nodes = {start};
+        std::set<Node*> visited = {start};
+        for (size_t i = 0; i < nodes.size(); ++i)
+            for (auto e : nodes[i]->edges)
+                if (visited.insert(e.second).second)
+                    nodes.push_back(e.second);
+        for (Node* n : nodes)
+            delete n;
+    }
+
+    template <typename Emit>
+    void scanWith(const std::string& code, Emit emit) const {
+        if (packedWidth == 8)
+            scanPacked(packed8, code, emit);
+        else if (packedWidth == 16)
+            scanPacked(packed16, code, emit);
+        else
+            scanPacked(packed32, code, emit);
+    }
 };
 
+const int Lexical::EPSILON;
 long long Lexical::Node::NODE_COUNT = 0;
-std::set<char> Lexical::NFA::charSet;  // 非终结符集
-#endif                                 // __LEXICAL_H__
+#endif  // __LEXICAL_H__
@@ -0,0 +1,111 @@
+#ifndef __LINEINDEX_H__
+#define __LINEINDEX_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINEINDEX_HAS_SIMD 1
+#endif
+
+// 换行符位置索引：记号只带字节偏移，需要行列号时(报错等)才用二分查找换算
+// 构建时用SIMD按块比较找'\n'，源码较大时分段多线程查找；索引引用code，不能比code活得久
+class LineIndex {
+   public:
+    // 行号从1开始；列号从1开始，按UTF-8码点计
+    struct Position {
+        size_t line;
+        size_t column;
+    };
+
+    LineIndex(const std::string& code, unsigned threads = 1) : code(code) {
+        Stats::Scope scope("lineindex.build");
+        const size_t MIN_CHUNK = 1 << 20;
+        size_t n = code.size();
+        if (threads <= 1 || n < 2 * MIN_CHUNK) {
+            find(code.data(), 0, n, newlines);
+            return;
+        }
+
+        threads = std::min<size_t>(threads, n / MIN_CHUNK);
+        size_t chunk = (n + threads - 1) / threads;
+        std::vector<std::vector<size_t>> parts(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back([&, t]() { find(code.data(), t * chunk, std::min(n, (t + 1) * chunk), parts[t]); });
+        find(code.data(), 0, std::min(n, chunk), parts[0]);
+        for (auto& w : workers)
+            w.join();
+        for (const auto& part : parts)
+            newlines.insert(newlines.end(), part.begin(), part.end());
+    }
+
+    Position at(size_t offset) const {
+        offset = std::min(offset, code.size());
+        // 偏移之前的换行符个数就是所在行之前的行数
+        size_t line = std::lower_bound(newlines.begin(), newlines.end(), offset) - newlines.begin();
+        size_t begin = line == 0 ? 0 : newlines[line - 1] + 1;
+        size_t column = 1;
+        for (size_t i = begin; i < offset; ++i)
+            column += ((unsigned char)code[i] & 0xC0) != 0x80;
+        return {line + 1, column};
+    }
+
+    std::string format(size_t offset) const {
+        Position p = at(offset);
+        return std::to_string(p.line) + ":" + std::to_string(p.column);
+    }
+
+    size_t lines() const {
+        return newlines.size() + 1;
+    }
+
+    // [begin, end) 中'\n'的偏移追加到out，按从小到大的顺序
+    static void find(const char* data, size_t begin, size_t end, std::vector<size_t>& out) {
+#ifdef LINEINDEX_HAS_SIMD
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2)
+            begin = findAVX2(data, begin, end, out);
+        else
+            begin = findSSE2(data, begin, end, out);
+#endif
+        for (size_t i = begin; i < end; ++i)
+            if (data[i] == '\n')
+                out.push_back(i);
+    }
+
+   private:
+    const std::string& code;
+    std::vector<size_t> newlines;
+
+#ifdef LINEINDEX_HAS_SIMD
+    // 返回未处理部分的起点，不足一个向量的尾部由调用方逐字节处理
+    __attribute__((target("sse2"))) static size_t findSSE2(const char* data, size_t i, size_t end, std::vector<size_t>& out) {
+        const __m128i nl = _mm_set1_epi8('\n');
+        for (; i + 16 <= end; i += 16) {
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), nl));
+            for (; mask != 0; mask &= mask - 1)
+                out.push_back(i + __builtin_ctz(mask));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2"))) static size_t findAVX2(const char* data, size_t i, size_t end, std::vector<size_t>& out) {
+        const __m256i nl = _mm256_set1_epi8('\n');
+        for (; i + 32 <= end; i += 32) {
+            unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), nl));
+            for (; mask != 0; mask &= mask - 1)
+                out.push_back(i + __builtin_ctz(mask));
+        }
+        return i;
+    }
+#endif
+};
+
+#endif  // __LINEINDEX_H__
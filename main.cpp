@@ -1,47 +1,26 @@
+// --stats 报告各阶段的分配次数，见stats.h
+#define STATS_COUNT_ALLOCATIONS
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 
+#include "binfmt.h"
+#include "bytecode.h"
+#include "lang.h"
 #include "lexical.h"
+#include "lineindex.h"
+#include "server.h"
+#include "stats.h"
+#include "symbol.h"
 #include "syntax.h"
 
-enum TokenType {
-    Number,
-    Identifier,
-    Separator,
-    Operator,
-};
-
-const std::set<std::string> keywords = {
-    "int", "float", "char", "double", "long", "void", "return", "for", "while", "if", "else"};
-
-const std::string numberRgex = "((0|1|2|3|4|5|6|7|8|9)*.(0|1|2|3|4|5|6|7|8|9)|(0|1|2|3|4|5|6|7|8|9))(0|1|2|3|4|5|6|7|8|9)*";  // (d*.d|d)(d)*
-const std::string identifierRgex = "(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|A|B|C|D|E|F|G|H|I|J|K|L|M|N|O|P|Q|R|S|T|U|V|W|X|Y|Z|_)(a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|A|B|C|D|E|F|G|H|I|J|K|L|M|N|O|P|Q|R|S|T|U|V|W|X|Y|Z|_|0|1|2|3|4|5|6|7|8|9)*";
-const std::string separatorRgex = ",|;|{|}|[|]|\\(|\\)";
-const std::string operatorRgex = "+|-|\\*|/|%|&|\\||=|+=|-=|\\*=|/=|==|++|--|<|>|<=|>=|&=|%=|\\|=|!=";
-
-// 文法的产生式
-std::vector<std::pair<std::string, std::vector<std::string>>> productions = {
-    {"E", {"T", "E'"}},        // E -> T E'
-    {"E'", {"+", "T", "E'"}},  // E' -> + T E'
-    {"E'", {"-", "T", "E'"}},  // E' -> - T E'
-    {"E'", {"@"}},             // E' -> ε
-    {"T", {"F", "T'"}},        // T -> F T'
-    {"T'", {"*", "F", "T'"}},  // T' -> * F T'
-    {"T'", {"/", "F", "T'"}},  // T' -> / F T'
-    {"T'", {"@"}},             // T' -> ε
-    {"F", {"(", "E", ")"}},    // F -> ( E )
-    {"F", {"num"}},            // F -> num
-    {"F", {"id"}}              // F -> id
-};
-// 终结符集合
-std::set<std::string>
-    terminals = {"+", "-", "*", "/", "(", ")", "num", "id"};
-// 非终结符集合
-std::set<std::string> nonTerminals = {"E", "E'", "T", "T'", "F"};
-// 开始符号
-std::string startSymbol = "E";
-
 std::string readFile(const std::string& filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
@@ -54,36 +33,247 @@ std::string readFile(const std::string& filename) {
     return content;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc <= 1) {
-        std::cout << "输入要分析的源文件" << std::endl;
-        return 1;
+// 整个字符串是一个数时返回true
+bool parseNumber(const std::string& text, double& value) {
+    char* end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0';
+}
+
+// 线程数：只含数字且不超过4096
+bool parseCount(const std::string& text, unsigned& value) {
+    if (text.empty() || text.size() > 4 || text.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    unsigned long n = std::strtoul(text.c_str(), nullptr, 10);
+    if (n > 4096)
+        return false;
+    value = n;
+    return true;
+}
+
+// 按之前保存的profile重排DFA状态
+void loadProfile(Lexical& lexical, const std::string& path) {
+    Lexical::Profile profile;
+    if (!profile.load(path, lexical.states()))
+        std::cerr << "cannot read profile: " << path << std::endl;
+    else if (!lexical.applyProfile(&profile))
+        std::cerr << "profile does not match the lexer: " << path << std::endl;
+}
+
+// 命令行选项
+struct Options {
+    std::string filename;
+    std::vector<std::string> bindings;  // name=value
+    std::string profileIn, profileOut;
+    bool optimizeGrammar = false;
+    std::string binaryOut;  // 二进制输出的路径，"-"为标准输出
+    bool daemon = false;
+    std::string socketPath;
+    unsigned jobs = 1;  // 默认单线程：语言的NFA很小，多线程构造DFA只增加同步开销
+    unsigned workers = std::thread::hardware_concurrency();  // 常驻服务处理请求的线程数
+};
+
+// 诊断信息中的位置：记号下标 -> 字节偏移 -> 行:列，第一次报错时才建立换行符索引
+class Locations {
+   public:
+    Locations(const std::string& code, const std::string& name, unsigned threads) : code(code), name(name), threads(threads) {
     }
 
-    Lexical lexical = Lexical({{numberRgex, TokenType::Number}, {identifierRgex, TokenType::Identifier}, {separatorRgex, TokenType::Separator}, {operatorRgex, TokenType::Operator}});
-    std::string code = readFile(argv[1]);
-    auto tokens = lexical.scan(code);
-
-    // 细分种别代码 (int) (float) (void)
-    std::vector<std::pair<std::string, std::string>> tokens1;
-    for (auto it : tokens) {
-        if (it.first == TokenType::Number) {
-            tokens1.push_back({"num", it.second});
-        } else if (it.first == TokenType::Identifier) {
-            if (keywords.find(it.second) != keywords.end()) {
-                tokens1.push_back({it.second, it.second});
-            } else {
-                tokens1.push_back({"id", it.second});
-            }
-        } else if (it.first == TokenType::Separator) {
-            tokens1.push_back({it.second, it.second});
-        } else if (it.first == TokenType::Operator) {
-            tokens1.push_back({it.second, it.second});
+    // tokens是交给分析器的记号流
+    Syntax::Locator locator(const std::vector<Lexical::Token>& tokens) {
+        return [this, &tokens](size_t i) {
+            if (index == nullptr)
+                index.reset(new LineIndex(code, threads));
+            std::string position = index->format(i < tokens.size() ? tokens[i].offset : code.size());
+            return name.empty() ? position : name + ":" + position;
+        };
+    }
+
+   private:
+    const std::string& code;
+    std::string name;
+    unsigned threads;
+    std::unique_ptr<LineIndex> index;
+};
+
+// 二进制输出：记号的种别、偏移和长度，分析结果和诊断信息，格式见binfmt.h
+int emitBinary(const Lexical& lexical, const Syntax& syntax, const std::string& code, const std::string& path) {
+    int fd = path == "-" ? 1 : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "cannot open " << path << std::endl;
+        return 1;
+    }
+    BinaryWriter writer(fd);
+    SymbolTable symbols;
+    internKeywords(symbols);
+    Locations locations(code, "", 1);
+    auto tokens = classifyTokens(lexical.scanTokens(code, symbols, TokenType::Identifier), code, syntax);
+    std::vector<uint32_t> kinds;  // [终结符编号] -> 种别表下标，不是终结符的记号按词素查种别表
+    for (const auto& t : tokens) {
+        uint32_t kind = t.type;
+        if (kind == Syntax::NONE) {
+            kind = writer.kind(kindName(t, code, syntax));
+        } else {
+            if (kind >= kinds.size())
+                kinds.resize(kind + 1, UINT32_MAX);
+            if (kinds[kind] == UINT32_MAX)
+                kinds[kind] = writer.kind(syntax.name(kind));
+            kind = kinds[kind];
         }
+        writer.token(kind, t.offset, t.length, t.symbol);
+    }
+    std::vector<std::string> names(symbols.size());
+    for (size_t i = 0; i < names.size(); ++i)
+        names[i] = symbols.name(i);
+    writer.symbols(names);
+
+    std::ostringstream diagnostics;
+    writer.verdict(syntax.parse(tokens, code, diagnostics, false, locations.locator(tokens)));
+    std::istringstream lines(diagnostics.str());
+    std::string line;
+    while (std::getline(lines, line))
+        writer.diagnostic(line);
+    bool ok = writer.finish();
+    if (fd != 1)
+        close(fd);
+    return ok ? 0 : 1;
+}
+
+int run(const Options& options) {
+    Lexical lexical = Lexical(rgexList, options.jobs);
+    if (!options.profileIn.empty())
+        loadProfile(lexical, options.profileIn);
+    std::string code = readFile(options.filename);
+    if (!options.profileOut.empty() && !lexical.profile(code).save(options.profileOut)) {
+        std::cerr << "cannot write profile: " << options.profileOut << std::endl;
+        return 1;
     }
+    if (!options.binaryOut.empty()) {
+        Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol, options.optimizeGrammar);
+        return emitBinary(lexical, syntax, code, options.binaryOut);
+    }
+    SymbolTable symbols;
+    internKeywords(symbols);
+    Locations locations(code, options.filename, options.jobs);
+    Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol, options.optimizeGrammar);
+    // 记号带着符号编号，语法树的叶子和变量槽按它对应
+    auto tokens1 = classifyTokens(lexical.scanTokens(code, symbols, TokenType::Identifier), code, syntax);
 
     // 语法分析
-    Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol);
-    syntax.parse(tokens1);
+    if (!syntax.parse(tokens1, code, std::cout, true, locations.locator(tokens1)))
+        return 0;
+
+    // 生成字节码，命令行中的 name=value 作为变量绑定
+    auto tree = syntax.buildTree(tokens1, code);
+    Bytecode::Program program = Bytecode::compile(tree.get());
+    std::cout << "\nBytecode:" << std::endl;
+    program.dump(std::cout);
+
+    std::vector<double> binding(program.vars.size());
+    std::vector<bool> bound(program.vars.size());
+    for (const auto& arg : options.bindings) {
+        size_t eq = arg.find('=');
+        uint32_t symbol = eq == std::string::npos ? SymbolTable::NONE : symbols.find(arg.substr(0, eq));
+        int slot = symbol == SymbolTable::NONE ? -1 : program.slot(symbol);
+        if (slot < 0)
+            continue;
+        if (!parseNumber(arg.substr(eq + 1), binding[slot])) {
+            std::cerr << "bad binding: " << arg << ", expected name=number" << std::endl;
+            return 1;
+        }
+        bound[slot] = true;
+    }
+    for (size_t i = 0; i < program.vars.size(); ++i) {
+        if (!bound[i]) {
+            std::cout << "unbound variable: " << program.vars[i] << std::endl;
+            return 0;
+        }
+    }
+    VM vm(program);
+    std::cout << "Result: " << vm.run(binding.data()) << std::endl;
     return 0;
 }
+
+// 常驻服务模式：词法和文法只构建一次
+int serve(const Options& options) {
+    Lexical lexical = Lexical(rgexList, options.jobs);
+    if (!options.profileIn.empty())
+        loadProfile(lexical, options.profileIn);
+    Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol, options.optimizeGrammar);
+
+    // 响应内容：记号列表、分析结果和诊断信息
+    // 每个请求用自己的驻留表，编号只在请求内有效，请求结束后随之释放，常驻进程的内存不随见过的标识符增长
+    Server server(
+        [&](const std::string& code) {
+            SymbolTable symbols;
+            internKeywords(symbols);
+            Locations locations(code, "", 1);
+            auto tokens = classifyTokens(lexical.scanTokens(code, symbols, TokenType::Identifier), code, syntax);
+            std::ostringstream out;
+            out << "tokens " << tokens.size() << "\n";
+            for (const auto& t : tokens) {
+                out << kindName(t, code, syntax) << "\t";
+                out.write(code.data() + t.offset, t.length) << "\n";
+            }
+            std::ostringstream diagnostics;
+            bool ok = syntax.parse(tokens, code, diagnostics, false, locations.locator(tokens));
+            out << "verdict " << (ok ? "ok" : "error") << "\n"
+                << diagnostics.str();
+            return out.str();
+        },
+        options.workers);
+
+    if (!options.socketPath.empty())
+        return server.serveSocket(options.socketPath);
+    server.serve(0, 1);
+    std::cerr << server.latencyReport();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats")
+            Stats::enabled = true;
+        else if (arg == "--serve")
+            options.daemon = true;
+        else if (arg == "--socket" && i + 1 < argc)
+            options.daemon = true, options.socketPath = argv[++i];
+        else if (arg == "--jobs" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.jobs)) {
+                std::cerr << "bad --jobs value: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.workers)) {
+                std::cerr << "bad --workers value: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--profile" && i + 1 < argc)
+            options.profileIn = argv[++i];
+        else if (arg == "--profile-out" && i + 1 < argc)
+            options.profileOut = argv[++i];
+        else if (arg == "--optimize-grammar")
+            options.optimizeGrammar = true;
+        else if (arg == "--emit-binary" && i + 1 < argc)
+            options.binaryOut = argv[++i];
+        else if (options.filename.empty())
+            options.filename = arg;
+        else
+            options.bindings.push_back(arg);
+    }
+    if (options.daemon)
+        return serve(options);
+    if (options.filename.empty()) {
+        std::cout << "输入要分析的源文件" << std::endl;
+        return 1;
+    }
+
+    int ret = run(options);
+    if (Stats::enabled)
+        Stats::json(std::cerr);
+    return ret;
+}
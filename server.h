@@ -0,0 +1,326 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 固定大小的线程池
+class ThreadPool {
+   public:
+    ThreadPool(unsigned threads) {
+        if (threads == 0)
+            threads = 1;
+        for (unsigned i = 0; i < threads; ++i)
+            workers.emplace_back([this]() { work(); });
+    }
+
+    // 等待队列中的任务执行完再退出
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers)
+            t.join();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+   private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+
+// 常驻服务：词法DFA和分析表只构建一次，请求由线程池并发处理
+//
+// 请求与响应都是带长度的帧：
+//   <id> FILE <path>\n          分析文件
+//   <id> CODE <length>\n<bytes> 分析内联的源码，length不超过MAX_FRAME
+//   <id> STATS\n                返回请求延迟的分位数(微秒)
+//   请求头(换行之前)不超过MAX_LINE字节，过长时回复错误并关闭连接
+//   响应: <id> <length>\n<payload>，同一连接上的响应可能乱序，用id对应
+class Server {
+   public:
+    typedef std::function<std::string(const std::string& code)> Handler;
+
+    Server(Handler handler, unsigned threads) : handler(handler), pool(threads) {
+    }
+
+    // 从in读请求，响应写到out，读到EOF后等本连接的请求全部完成再返回
+    void serve(int in, int out) {
+        Connection conn(in, out);
+        std::string line;
+        bool truncated = false;
+        while (conn.readLine(line, truncated)) {
+            std::istringstream header(line);
+            std::string id, command;
+            header >> id >> command;
+            auto received = std::chrono::steady_clock::now();
+            if (truncated) {
+                conn.respond(id, "verdict error\nrequest header too long\n");
+                break;
+            }
+
+            if (command == "CODE") {
+                // 长度不合法时无法找到下一帧的开头，回复错误后关闭连接
+                std::string lengthText;
+                header >> lengthText;
+                size_t length = 0;
+                if (!parseLength(lengthText, length)) {
+                    conn.respond(id, "verdict error\nbad request: " + line + "\n");
+                    break;
+                }
+                std::string code;
+                if (!conn.readExact(length, code))
+                    break;
+                dispatch(conn, id, received, [this, code]() { return handler(code); });
+            } else if (command == "FILE") {
+                std::string path;
+                std::getline(header >> std::ws, path);
+                dispatch(conn, id, received, [this, path]() {
+                    std::ifstream file(path);
+                    if (!file.is_open())
+                        return std::string("verdict error\nno file: ") + path + "\n";
+                    std::string code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                    return handler(code);
+                });
+            } else if (command == "STATS") {
+                conn.respond(id, latencyReport());
+            } else {
+                conn.respond(id, "verdict error\nbad request: " + line + "\n");
+            }
+        }
+        conn.wait();
+    }
+
+    // 监听Unix域套接字，每个连接一个读线程，请求仍交给线程池
+    // 绑定前删除上次留下的套接字文件；收到SIGINT/SIGTERM时删除套接字文件后退出
+    int serveSocket(const std::string& path) {
+        signal(SIGPIPE, SIG_IGN);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (fd < 0 || path.size() >= sizeof(addr.sun_path))
+            return 1;
+        std::strcpy(addr.sun_path, path.c_str());
+        unlink(path.c_str());
+        // listen之前改成只有属主可连接，FILE请求会读取本进程能读的任何文件
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || chmod(path.c_str(), 0600) != 0 || listen(fd, 64) != 0) {
+            close(fd);
+            unlink(path.c_str());
+            return 1;
+        }
+        std::strcpy(socketPath, path.c_str());
+        signal(SIGINT, removeSocket);
+        signal(SIGTERM, removeSocket);
+        while (true) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            std::thread([this, client]() {
+                serve(client, client);
+                close(client);
+            }).detach();
+        }
+    }
+
+    // 最近请求的延迟分位数，单位微秒
+    std::string latencyReport() {
+        std::vector<long long> samples;
+        long long total = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            samples = latencies;
+            total = requests;
+        }
+        std::ostringstream out;
+        out << "requests " << total << "\n";
+        if (samples.empty())
+            return out.str();
+        std::sort(samples.begin(), samples.end());
+        for (double q : {0.5, 0.9, 0.99, 1.0}) {
+            size_t i = std::min(samples.size() - 1, (size_t)(q * samples.size()));
+            out << "p" << q * 100 << "_us " << samples[i] << "\n";
+        }
+        return out.str();
+    }
+
+    static const size_t MAX_FRAME = 64 << 20;  // CODE请求的最大字节数
+    static const size_t MAX_LINE = 8 << 10;    // 请求头的最大字节数，FILE的路径不超过PATH_MAX
+
+   private:
+    static const size_t MAX_SAMPLES = 1 << 16;  // 只保留最近的延迟样本
+
+    Handler handler;
+    ThreadPool pool;
+    std::mutex mutex;
+    std::vector<long long> latencies;
+    long long requests = 0;
+
+    static char socketPath[sizeof(sockaddr_un::sun_path)];  // 信号处理函数里只能用固定的缓冲区
+
+    // 只调用异步信号安全的unlink和_exit
+    static void removeSocket(int) {
+        unlink(socketPath);
+        _exit(0);
+    }
+
+    class Connection {
+       public:
+        Connection(int in, int out) : in(in), out(out) {
+        }
+
+        // 超过MAX_LINE字节仍没有换行时置truncated，line为开头的MAX_LINE字节
+        bool readLine(std::string& line, bool& truncated) {
+            truncated = false;
+            while (true) {
+                size_t nl = buffer.find('\n', head);
+                if (nl != std::string::npos && nl - head <= MAX_LINE) {
+                    line = buffer.substr(head, nl - head);
+                    head = nl + 1;
+                    return true;
+                }
+                if (buffer.size() - head > MAX_LINE) {
+                    line = buffer.substr(head, MAX_LINE);
+                    truncated = true;
+                    return true;
+                }
+                if (!fill())
+                    return false;
+            }
+        }
+
+        bool readExact(size_t length, std::string& data) {
+            while (buffer.size() - head < length)
+                if (!fill())
+                    return false;
+            data = buffer.substr(head, length);
+            head += length;
+            return true;
+        }
+
+        void respond(const std::string& id, const std::string& payload) {
+            std::string frame = id + " " + std::to_string(payload.size()) + "\n" + payload;
+            std::lock_guard<std::mutex> lock(writeMutex);
+            size_t written = 0;
+            while (written < frame.size()) {
+                ssize_t n = write(out, frame.data() + written, frame.size() - written);
+                if (n <= 0)
+                    return;
+                written += n;
+            }
+        }
+
+        void begin() {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            pending++;
+        }
+
+        void end() {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (--pending == 0)
+                done.notify_all();
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            done.wait(lock, [this]() { return pending == 0; });
+        }
+
+       private:
+        int in;
+        int out;
+        std::string buffer;
+        size_t head = 0;
+        std::mutex writeMutex;
+        std::mutex pendingMutex;
+        std::condition_variable done;
+        int pending = 0;
+
+        bool fill() {
+            if (head > 0) {
+                buffer.erase(0, head);
+                head = 0;
+            }
+            char chunk[1 << 16];
+            ssize_t n = read(in, chunk, sizeof(chunk));
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, n);
+            return true;
+        }
+    };
+
+    // 十进制的帧长度，不超过MAX_FRAME
+    static bool parseLength(const std::string& text, size_t& length) {
+        if (text.empty() || text.size() > 10 || text.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        length = std::stoull(text);
+        return length <= MAX_FRAME;
+    }
+
+    void dispatch(Connection& conn, const std::string& id, std::chrono::steady_clock::time_point received, std::function<std::string()> work) {
+        conn.begin();
+        pool.submit([this, &conn, id, received, work]() {
+            conn.respond(id, work());
+            long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received).count();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (latencies.size() < MAX_SAMPLES)
+                    latencies.push_back(us);
+                else
+                    latencies[requests % MAX_SAMPLES] = us;
+                requests++;
+            }
+            conn.end();
+        });
+    }
+};
+
+const size_t Server::MAX_FRAME;
+const size_t Server::MAX_LINE;
+char Server::socketPath[sizeof(sockaddr_un::sun_path)];
+const size_t Server::MAX_SAMPLES;
+#endif  // __SERVER_H__
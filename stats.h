@@ -0,0 +1,150 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+
+// 各阶段的耗时、内存分配与计数器，--stats 时以JSON输出
+// 未开启时Scope和count只检查一个标志位
+class Stats {
+   public:
+    struct Phase {
+        long long calls = 0;
+        double seconds = 0;  // 包含嵌套阶段的时间
+        long long allocs = 0;
+        long long allocBytes = 0;
+    };
+
+    // 统计一个作用域的耗时与分配次数，累加到同名阶段
+    // 分配次数取自本线程的计数，不含同一时间其他线程的分配；阶段内另起的工作线程的分配只计入总数
+    class Scope {
+       public:
+        Scope(const char* name) : name(name) {
+            if (!enabled)
+                return;
+            allocs = threadAllocs;
+            allocBytes = threadAllocBytes;
+            begin = std::chrono::steady_clock::now();
+        }
+
+        ~Scope() {
+            if (!enabled)
+                return;
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            std::lock_guard<std::mutex> lock(mutex);
+            Phase& phase = phases[name];
+            phase.calls++;
+            phase.seconds += seconds;
+            phase.allocs += threadAllocs - allocs;
+            phase.allocBytes += threadAllocBytes - allocBytes;
+        }
+
+       private:
+        const char* name;
+        long long allocs = 0;
+        long long allocBytes = 0;
+        std::chrono::steady_clock::time_point begin;
+    };
+
+    // 在局部累加，离开作用域时一次性计入，适合热循环里的计数
+    class Counter {
+       public:
+        long long value = 0;
+
+        Counter(const char* name) : name(name) {
+        }
+
+        ~Counter() {
+            count(name, value);
+        }
+
+       private:
+        const char* name;
+    };
+
+    static void count(const char* name, long long delta) {
+        if (!enabled)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        counters[name] += delta;
+    }
+
+    static long long counter(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = counters.find(name);
+        return it == counters.end() ? 0 : it->second;
+    }
+
+    static void json(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "{\"phases\":{";
+        const char* sep = "";
+        for (const auto& entry : phases) {
+            const Phase& p = entry.second;
+            out << sep << "\"" << entry.first << "\":{\"calls\":" << p.calls << ",\"ms\":" << p.seconds * 1000
+                << ",\"allocs\":" << p.allocs << ",\"alloc_bytes\":" << p.allocBytes << "}";
+            sep = ",";
+        }
+        out << "},\"counters\":{";
+        sep = "";
+        for (const auto& entry : counters) {
+            out << sep << "\"" << entry.first << "\":" << entry.second;
+            sep = ",";
+        }
+        out << "},\"allocs\":" << allocs.load() << ",\"alloc_bytes\":" << allocBytes.load() << "}" << std::endl;
+    }
+
+    static bool enabled;
+    static std::atomic<long long> allocs;  // 全进程
+    static std::atomic<long long> allocBytes;
+    static thread_local long long threadAllocs;  // 本线程，供Scope计算各阶段的分配
+    static thread_local long long threadAllocBytes;
+
+   private:
+    static std::mutex mutex;
+    static std::map<std::string, Phase> phases;
+    static std::map<std::string, long long> counters;
+};
+
+bool Stats::enabled = false;
+std::atomic<long long> Stats::allocs(0);
+std::atomic<long long> Stats::allocBytes(0);
+thread_local long long Stats::threadAllocs = 0;
+thread_local long long Stats::threadAllocBytes = 0;
+std::mutex Stats::mutex;
+std::map<std::string, Stats::Phase> Stats::phases;
+std::map<std::string, long long> Stats::counters;
+
+// 替换全局operator new以统计分配次数和字节数
+// 只有在包含本文件之前定义了STATS_COUNT_ALLOCATIONS的程序才替换(整个程序只能定义一次)，其余程序的分配计数为0
+// delete不内联，编译器看到的始终是与new配对的operator delete
+#ifdef STATS_COUNT_ALLOCATIONS
+void* operator new(std::size_t size) {
+    if (Stats::enabled) {
+        Stats::allocs.fetch_add(1, std::memory_order_relaxed);
+        Stats::allocBytes.fetch_add(size, std::memory_order_relaxed);
+        Stats::threadAllocs++;
+        Stats::threadAllocBytes += size;
+    }
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+#endif  // __STATS_H__
@@ -0,0 +1,180 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// 标识符驻留表：同名标识符只存一份，映射到从0开始连续的符号编号
+// 名字存放在按块分配的arena中，地址不会变；哈希表是开放定址、线性探测，槽中存符号编号
+class SymbolTable {
+   public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    SymbolTable() : slots(INITIAL_SLOTS, NONE) {
+    }
+
+    static uint64_t hash(const char* text, size_t length) {
+        uint64_t h = 1469598103934665603ULL;  // FNV-1a
+        for (size_t i = 0; i < length; ++i)
+            h = (h ^ (unsigned char)text[i]) * 1099511628211ULL;
+        return h;
+    }
+
+    uint32_t intern(const std::string& name) {
+        return intern(name.data(), name.size());
+    }
+
+    uint32_t intern(const char* text, size_t length) {
+        return intern(text, length, hash(text, length));
+    }
+
+    // hash必须是hash(text, length)的结果
+    uint32_t intern(const char* text, size_t length, uint64_t h) {
+        size_t slot = probe(text, length, h);
+        if (slots[slot] != NONE)
+            return slots[slot];
+        uint32_t id = entries.size();
+        entries.push_back({store(text, length), (uint32_t)length, h});
+        slots[slot] = id;
+        if (entries.size() * 2 > slots.size())
+            rehash();
+        return id;
+    }
+
+    // 不存在时返回NONE
+    uint32_t find(const char* text, size_t length, uint64_t h) const {
+        return slots[probe(text, length, h)];
+    }
+
+    uint32_t find(const std::string& name) const {
+        return find(name.data(), name.size(), hash(name.data(), name.size()));
+    }
+
+    std::string name(uint32_t id) const {
+        return std::string(entries[id].text, entries[id].length);
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    // arena、符号项与哈希槽占用的字节数
+    size_t memoryBytes() const {
+        return blocks.size() * BLOCK + large + entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(uint32_t);
+    }
+
+   private:
+    static const size_t INITIAL_SLOTS = 1024;
+    static const size_t BLOCK = 64 * 1024;  // arena的块大小，更长的名字单独分配
+
+    struct Entry {
+        const char* text;
+        uint32_t length;
+        uint64_t hash;
+    };
+
+    std::vector<Entry> entries;  // [符号编号]
+    std::vector<uint32_t> slots;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<std::unique_ptr<char[]>> largeNames;
+    size_t used = 0;  // 当前块已用的字节数
+    size_t large = 0;
+
+    // 返回名字所在的槽，或者应该插入的空槽
+    size_t probe(const char* text, size_t length, uint64_t h) const {
+        size_t mask = slots.size() - 1;
+        for (size_t slot = h & mask;; slot = (slot + 1) & mask) {
+            uint32_t id = slots[slot];
+            if (id == NONE)
+                return slot;
+            const Entry& e = entries[id];
+            if (e.hash == h && e.length == length && std::memcmp(e.text, text, length) == 0)
+                return slot;
+        }
+    }
+
+    const char* store(const char* text, size_t length) {
+        char* p;
+        if (length > BLOCK / 4) {
+            largeNames.emplace_back(new char[length]);
+            large += length;
+            p = largeNames.back().get();
+        } else {
+            if (blocks.empty() || used + length > BLOCK) {
+                blocks.emplace_back(new char[BLOCK]);
+                used = 0;
+            }
+            p = blocks.back().get() + used;
+            used += length;
+        }
+        std::memcpy(p, text, length);
+        return p;
+    }
+
+    void rehash() {
+        slots.assign(slots.size() * 2, NONE);
+        size_t mask = slots.size() - 1;
+        for (uint32_t id = 0; id < entries.size(); ++id) {
+            size_t slot = entries[id].hash & mask;
+            while (slots[slot] != NONE)
+                slot = (slot + 1) & mask;
+            slots[slot] = id;
+        }
+    }
+};
+
+// 多线程共用的驻留表：查找持共享锁，插入时持独占锁并重新查找
+// 已有的名字(常见情况)只需要共享锁，各线程得到的编号一致
+class ConcurrentSymbolTable {
+   public:
+    static const uint32_t NONE = SymbolTable::NONE;
+
+    uint32_t intern(const std::string& name) {
+        return intern(name.data(), name.size());
+    }
+
+    uint32_t intern(const char* text, size_t length) {
+        return intern(text, length, SymbolTable::hash(text, length));
+    }
+
+    uint32_t intern(const char* text, size_t length, uint64_t h) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            uint32_t id = table.find(text, length, h);
+            if (id != NONE)
+                return id;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        return table.intern(text, length, h);
+    }
+
+    uint32_t find(const std::string& name) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return table.find(name);
+    }
+
+    std::string name(uint32_t id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return table.name(id);
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return table.size();
+    }
+
+   private:
+    mutable std::shared_mutex mutex;
+    SymbolTable table;
+};
+
+const uint32_t SymbolTable::NONE;
+const size_t SymbolTable::INITIAL_SLOTS;
+const size_t SymbolTable::BLOCK;
+const uint32_t ConcurrentSymbolTable::NONE;
+#endif  // __SYMBOL_H__
@@ -1,24 +1,78 @@
 #ifndef __SYNTAX_H__
 #define __SYNTAX_H__
 
+#include <cstdint>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <stack>
 #include <string>
 #include <vector>
 
+#include "grammar.h"
+#include "lexical.h"
+#include "stats.h"
+
 class Syntax {
    public:
+    // 语法树结点
+    struct TreeNode {
+        std::string symbol;  // 文法符号
+        std::string lexeme;  // 终结符对应的词素
+        uint32_t id = UINT32_MAX;  // 驻留过的标识符的符号编号(见symbol.h)，建树时给出symbols才有
+        uint64_t priority = 0;     // 长尾链的组在treap中的优先级，见tails
+        std::vector<std::shared_ptr<TreeNode>> children;
+        size_t size = UNKNOWN;  // 覆盖的记号数
+
+        static const size_t UNKNOWN = -1;
+
+        TreeNode(const std::string& symbol) : symbol(symbol) {
+        }
+    };
+
+    static const uint32_t NONE = UINT32_MAX;  // 不是终结符的记号种别，如文法中没有的关键字
+
+    // optimize为true时先做文法变换(见grammar.h)，分析时以终结符开头的产生式直接匹配该终结符，不再入栈
     Syntax(const std::vector<std::pair<std::string, std::vector<std::string>>>& prods,
            const std::set<std::string>& terms,
-           const std::set<std::string>& nonTerms, const std::string& s)
-        : productions(prods), terminals(terms), nonTerminals(nonTerms), start(s) {
+           const std::set<std::string>& nonTerms, const std::string& s, bool optimize = false)
+        : productions(prods), terminals(terms), nonTerminals(nonTerms), start(s), optimized(optimize) {
+        if (optimize) {
+            Grammar grammar(prods, terms, nonTerms, s);
+            grammar.optimize();
+            productions = grammar.productions;
+            nonTerminals = grammar.nonTerminals;
+        }
+        constructSymbols();
         constructFirstSet();
         constructFollowSet();
         constructSelectSet();
         constructParseTable();
+        constructTails();
+    }
+
+    // 种别名对应的终结符编号，不是终结符时返回NONE；分析时记号的种别用这个编号表示
+    uint32_t terminal(const std::string& kind) const {
+        auto it = symbolIds.find(kind);
+        return it != symbolIds.end() && it->second < endSymbol ? it->second : NONE;
+    }
+
+    // 文法符号的名字
+    const std::string& name(uint32_t symbol) const {
+        return symbolNames[symbol];
+    }
+
+    void displayProductions() const {
+        std::cout << "Productions:" << std::endl;
+        for (const auto& prod : productions) {
+            std::cout << prod.first << " ->";
+            for (const auto& symbol : prod.second)
+                std::cout << " " << symbol;
+            std::cout << std::endl;
+        }
     }
 
     void displayFirstSets() const {
@@ -48,12 +102,12 @@ class Syntax {
         for (const auto& entry : selectSet) {
             std::cout << "Select[" << entry.first.first << "->";
 
-            for (int i = 0; i < entry.first.second.size(); ++i) {
+            for (size_t i = 0; i < entry.first.second.size(); ++i) {
                 std::cout << entry.first.second[i];
             }
             std::cout << "]={";
 
-            int idx = 0;
+            size_t idx = 0;
             for (const auto& symbol : entry.second) {
                 if (idx != entry.second.size() - 1) {
                     std::cout << symbol << ",";
@@ -102,85 +156,224 @@ class Syntax {
         }
     }
 
-    // 下推自动机
-    bool parse(std::vector<std::pair<std::string, std::string>>& tokens) const {
-        std::stack<std::string> stk;
-        stk.push("#");    // 输入结束符
-        stk.push(start);  // 开始符号
+    // 记号下标 -> 源码位置的描述，用于诊断信息的前缀；结束符#的下标为tokens.size()
+    typedef std::function<std::string(size_t index)> Locator;
+
+    // 下推自动机，分析过程与诊断信息写入out，trace为false时只输出诊断
+    // 记号的type是终结符编号(见terminal)，词素只在输出诊断时从code中取出
+    // 给出locate时诊断信息以 "位置: " 开头，只在出错时调用
+    bool parse(const std::vector<Lexical::Token>& tokens, const std::string& code, std::ostream& out = std::cout, bool trace = true,
+               const Locator& locate = nullptr) const {
+        Stats::Scope scope("syntax.parse");
+        Stats::Counter steps("parse.steps");
+        Stats::Counter stackOps("parse.stack_ops");  // 入栈与出栈次数
+        std::vector<uint32_t> stk;
+        stk.push_back(endSymbol);    // 输入结束符
+        stk.push_back(startSymbol);  // 开始符号
 
-        tokens.push_back({"#", "#"});  // 在输入流的结尾添加结束符，便于对比
+        auto where = [&](size_t i) { return locate ? locate(i) + ": " : std::string(); };
+        // 输入流的结尾视为结束符#
+        auto lexeme = [&](size_t i) { return i < tokens.size() ? code.substr(tokens[i].offset, tokens[i].length) : std::string("#"); };
 
         size_t index = 0;
+        bool recovered = false;  // 同步恢复过的输入即使分析到结尾也不算成功
         while (!stk.empty()) {
-            std::string top = stk.top();
-            std::string token = tokens[index].first;
+            uint32_t top = stk.back();
+            uint32_t token = kindAt(tokens, index);
+            steps.value++;
 
-            auto tmp = stk;
-            while (!tmp.empty()) {
-                std::cout << tmp.top() << " ";
-                tmp.pop();
+            if (trace) {
+                for (size_t i = stk.size(); i-- > 0;)
+                    out << symbolNames[stk[i]] << " ";
+                out << '\n';
             }
-            std::cout << std::endl;
 
-            if (terminals.find(top) != terminals.end() || top == "#") {
+            if (top <= endSymbol) {
                 if (top == token) {
                     // 匹配终结符
-                    stk.pop();
+                    stk.pop_back();
+                    stackOps.value++;
                     index++;
                 } else {
-                    std::cout << "Syntax error: unexpected token " << tokens[index].second << ", expected " << top << std::endl;
+                    out << where(index) << "Syntax error: unexpected token " << lexeme(index) << ", expected " << symbolNames[top] << '\n';
                     return false;
                 }
-            } else if (nonTerminals.find(top) != nonTerminals.end()) {
-                if (!parseTable.at({top, token}).empty()) {
-                    // 使用对应的产生式替换栈顶的非终结符
-                    stk.pop();
-                    const auto& production = parseTable.at({top, token});
-                    if (!(production.size() == 1 && production[0] == "@")) {  // 如果不是产生式@，则逆序加入栈中
-                        for (auto it = production.rbegin(); it != production.rend(); ++it) {
-                            stk.push(*it);
-                        }
+            } else if (top != NONE) {
+                int rule = entry(top, token);
+                if (rule >= 0) {
+                    // 使用对应的产生式替换栈顶的非终结符，产生式@的右部为空
+                    stk.pop_back();
+                    stackOps.value++;
+                    const auto& production = rules[rule];
+                    size_t first = 0;
+                    if (optimized && !production.empty() && production[0] < endSymbol) {
+                        // select集保证首终结符就是当前记号
+                        first = 1;
+                        index++;
+                    }
+                    for (size_t i = production.size(); i-- > first;) {
+                        stk.push_back(production[i]);
+                        stackOps.value++;
                     }
                 } else {
-                    std::cout << "Syntax error: no production rule for (" << top << ", " << tokens[index].second << ")" << std::endl;
+                    out << where(index) << "Syntax error: no production rule for (" << symbolNames[top] << ", " << lexeme(index) << ")\n";
                     // 尝试同步消费输入记号或跳过输入查看同步点
                     bool foundSync = false;
-                    while (!stk.empty() && (!parseTable.at({stk.top(), token}).empty() && parseTable.at({stk.top(), token})[0] == "synch")) {
-                        stk.pop();
+                    while (!stk.empty() && entry(stk.back(), token) == SYNCH) {
+                        stk.pop_back();
+                        stackOps.value++;
                         foundSync = true;
                     }
                     if (!foundSync) {
                         return false;
                     }
+                    recovered = true;
                 }
             } else {
-                std::cout << "Syntax error: invalid  " << tokens[index].second << std::endl;
+                out << where(index) << "Syntax error: invalid  " << lexeme(index) << '\n';
                 return false;
             }
         }
 
-        if (stk.empty() && tokens[index - 1].first == "#") {
-            std::cout << "Parsing successful!" << std::endl;
+        // 栈只在匹配结束符后才会变空
+        if (recovered) {
+            return false;
+        } else if (stk.empty() && index == tokens.size() + 1) {
+            if (trace)
+                out << "Parsing successful!\n";
             return true;  // 成功解析
         } else {
-            std::cout << "Syntax error: unexpected end of input" << std::endl;
+            out << where(tokens.size()) << "Syntax error: unexpected end of input\n";
             return false;
         }
     }
 
+    // 下推自动机构建语法树，不输出分析过程，出错时返回nullptr
+    // 记号同parse；叶子的词素从code中取出，记号的符号编号记在叶子的id上
+    std::shared_ptr<TreeNode> buildTree(const std::vector<Lexical::Token>& tokens, const std::string& code) const {
+        Stats::Scope scope("syntax.buildTree");
+        size_t index = 0;
+        auto root = derive(startSymbol, tokens, code, index, nullptr);
+        return root != nullptr && index == tokens.size() ? root : nullptr;
+    }
+
+    // 增量分析：旧记号流中[editBegin, oldEnd)被替换成新记号流中的[editBegin, newEnd)
+    // 只对包含修改的最小子树重新运行下推自动机，修改之外的子树按引用复用，结果与buildTree相同(长尾链的treap形状可能不同，见tails)
+    // 重新分析的子树结束位置和原来对不上时，退到父结点再试，最后退到整棵树
+    // 修改附近的旧结点开始时按(符号, 起始位置)建一次索引；长尾链存成treap，找子树、拼接旧链和复制祖先结点
+    // 经过的结点数是括号嵌套深度加上treap的高度，与源码长度成对数，不随表达式的项数线性增长
+    // tokens和code是修改后的记号流与源码，复用的旧叶子保留原来的词素和符号编号
+    std::shared_ptr<TreeNode> reparse(const std::shared_ptr<TreeNode>& old, const std::vector<Lexical::Token>& tokens, const std::string& code,
+                                      size_t editBegin, size_t oldEnd, size_t newEnd) const {
+        Stats::Scope scope("syntax.reparse");
+        if (old == nullptr)
+            return buildTree(tokens, code);
+
+        // 1. 从根向下找起点在修改之前、终点不早于修改末尾的非终结符结点
+        size_t lo = editBegin > 0 ? editBegin - 1 : 0;
+        std::vector<std::pair<std::shared_ptr<TreeNode>, size_t>> path = {{old, 0}};  // (结点, 起始位置)
+        while (true) {
+            std::shared_ptr<TreeNode> next;
+            size_t nextStart = 0;
+            forChildren(path.back().first.get(), path.back().second, lo, oldEnd, [&](const std::shared_ptr<TreeNode>& child, size_t childStart) {
+                if (next == nullptr && child->size > 0 && childStart < editBegin && childStart + child->size >= oldEnd &&
+                    nonTerminals.find(child->symbol) != nonTerminals.end()) {
+                    next = child;
+                    nextStart = childStart;
+                }
+            });
+            if (next == nullptr)
+                break;
+            path.push_back({next, nextStart});
+        }
+
+        // 2. 由深到浅重新展开，成功后复制路径上的祖先结点
+        Reuse reuse = {editBegin, oldEnd, newEnd, {}};
+        indexNodes(old, reuse);
+        long long delta = (long long)newEnd - (long long)oldEnd;
+        for (size_t k = path.size(); k-- > 0;) {
+            const auto& node = path[k].first;
+            size_t nodeStart = path[k].second;
+            size_t index = nodeStart;
+            auto fresh = derive(symbolIds.at(node->symbol), tokens, code, index, &reuse);
+            // 修改之前的记号没变，整体分析也会在同一位置展开这个结点并在同样的地方出错
+            if (fresh == nullptr)
+                return nullptr;
+            if (k == 0)
+                return index == tokens.size() ? fresh : nullptr;
+            if ((long long)index != (long long)(nodeStart + node->size) + delta)
+                continue;
+
+            for (size_t j = k; j-- > 0;)
+                fresh = replaceChild(path[j].first, path[j].second, path[j + 1].first.get(), path[j + 1].second, fresh);
+            return fresh;
+        }
+        return nullptr;
+    }
+
    private:
     std::vector<std::pair<std::string, std::vector<std::string>>>
         productions;
     std::set<std::string> terminals;
     std::set<std::string> nonTerminals;
     std::string start;
+    bool optimized;
+    // 文法符号的编号：终结符在前，然后是结束符#，其后是非终结符
+    std::map<std::string, uint32_t> symbolIds;
+    std::vector<std::string> symbolNames;
+    uint32_t endSymbol;
+    uint32_t startSymbol;
+    std::vector<std::vector<uint32_t>> rules;  // [产生式下标] -> 右部的符号编号，产生式@为空
+    std::vector<int> table;                    // [(非终结符编号 - endSymbol - 1) * (endSymbol + 1) + 终结符编号] -> 产生式下标，或ERROR、SYNCH
+    std::vector<bool> tailIds;                 // [符号编号] -> 是否长尾链
     std::map<std::string, std::set<std::string>> firstSet;
     std::map<std::string, std::set<std::string>> followSet;
     std::map<std::pair<std::string, std::vector<std::string>>, std::set<std::string>> selectSet;
     std::map<std::pair<std::string, std::string>, std::vector<std::string>> parseTable;  // 预测分析表
+    std::set<std::string> tails;                                                         // 长尾链，见constructTails
+
+    enum { ERROR = -1, SYNCH = -2 };  // 预测分析表中不是产生式的项
+
+    // 记号流之后视为结束符#
+    uint32_t kindAt(const std::vector<Lexical::Token>& tokens, size_t index) const {
+        return index < tokens.size() ? (uint32_t)tokens[index].type : endSymbol;
+    }
+
+    // 预测分析表中(非终结符, 终结符)的项；symbol不是非终结符或kind不是终结符时为ERROR
+    int entry(uint32_t symbol, uint32_t kind) const {
+        if (symbol <= endSymbol || symbol == NONE || kind > endSymbol)
+            return ERROR;
+        return table[(symbol - endSymbol - 1) * (endSymbol + 1) + kind];
+    }
+
+    // 给文法符号编号，把产生式的右部换成编号
+    void constructSymbols() {
+        for (const auto& terminal : terminals) {
+            symbolIds[terminal] = symbolNames.size();
+            symbolNames.push_back(terminal);
+        }
+        endSymbol = symbolNames.size();
+        symbolIds["#"] = endSymbol;
+        symbolNames.push_back("#");
+        for (const auto& nonTerminal : nonTerminals) {
+            symbolIds[nonTerminal] = symbolNames.size();
+            symbolNames.push_back(nonTerminal);
+        }
+        startSymbol = symbolIds.at(start);
+        for (const auto& prod : productions) {
+            std::vector<uint32_t> rhs;
+            if (!(prod.second.size() == 1 && prod.second[0] == "@"))
+                for (const auto& symbol : prod.second) {
+                    auto it = symbolIds.find(symbol);
+                    rhs.push_back(it != symbolIds.end() ? it->second : NONE);
+                }
+            rules.push_back(rhs);
+        }
+    }
 
     // 构建first集
     void constructFirstSet() {
+        Stats::Scope scope("syntax.firstSet");
         for (const auto& nonTerminal : nonTerminals) {
             firstSet[nonTerminal] = {};
         }
@@ -221,6 +414,7 @@ class Syntax {
 
     // 构建follow集
     void constructFollowSet() {
+        Stats::Scope scope("syntax.followSet");
         for (const auto& nonTerminal : nonTerminals) {
             followSet[nonTerminal] = {};
         }
@@ -279,6 +473,7 @@ class Syntax {
 
     // 构建select集
     void constructSelectSet() {
+        Stats::Scope scope("syntax.selectSet");
         for (const auto& prod : productions) {
             // A->a
             // 如果a=>@，则Select(A->a) = First(a)
@@ -329,6 +524,7 @@ class Syntax {
 
     // 构建预测分析表
     void constructParseTable() {
+        Stats::Scope scope("syntax.parseTable");
         // 1. 初始化预测分析表
         std::set<std::string> tmp = terminals;
         tmp.insert("#");
@@ -361,7 +557,463 @@ class Syntax {
                 }
             }
         }
+
+        // 3. 按符号编号排成数组，分析时不再比较字符串
+        std::map<std::pair<std::string, std::vector<std::string>>, int> ruleIndex;
+        for (size_t i = 0; i < productions.size(); ++i)
+            ruleIndex[productions[i]] = i;
+        table.assign(nonTerminals.size() * (endSymbol + 1), ERROR);
+        for (const auto& item : parseTable) {
+            int& cell = table[(symbolIds.at(item.first.first) - endSymbol - 1) * (endSymbol + 1) + symbolIds.at(item.first.second)];
+            if (item.second.empty())
+                cell = ERROR;
+            else if (item.second[0] == "synch")
+                cell = SYNCH;
+            else
+                cell = ruleIndex.at({item.first.first, item.second});
+        }
+    }
+
+    // 长尾链：右递归的非终结符(如E' -> + T E')。语法树中不逐层嵌套，每用一次产生式生成一个与链同名的组结点，
+    // 孩子是产生式去掉末尾自身后的符号；整条链的组按位置组成treap，首尾与自身同名的孩子是左右子树
+    // 这样树高与链长成对数，表达式的项再多也不会逐层加深。组结点必须不为空并且能和左右子树区分开，
+    // 所以要求产生式的首符号推不出空串、倒数第二个符号不是自身
+    void constructTails() {
+        for (const auto& nonTerminal : nonTerminals) {
+            bool recursive = false, simple = true;
+            for (const auto& prod : productions) {
+                const auto& rhs = prod.second;
+                if (prod.first != nonTerminal || (rhs.size() == 1 && rhs[0] == "@"))
+                    continue;
+                if (rhs.size() > 1 && rhs.back() == nonTerminal)
+                    recursive = true;
+                if (rhs[0] == nonTerminal || (rhs.size() > 1 && rhs[rhs.size() - 2] == nonTerminal) ||
+                    (nonTerminals.find(rhs[0]) != nonTerminals.end() && firstSet.at(rhs[0]).count("@") != 0))
+                    simple = false;
+            }
+            if (recursive && simple)
+                tails.insert(nonTerminal);
+        }
+        tailIds.assign(symbolNames.size(), false);
+        for (const auto& tail : tails)
+            tailIds[symbolIds.at(tail)] = true;
+    }
+
+    // 增量分析时可以复用的旧子树：位于修改之前(连同向前看的记号)或修改之后的结点
+    struct Reuse {
+        size_t editBegin;
+        size_t oldEnd;
+        size_t newEnd;
+        std::map<std::pair<std::string, size_t>, std::shared_ptr<TreeNode>> nodes;  // (符号, 旧起始位置) -> 修改附近的旧结点
+
+        // 新位置pos处的symbol结点对应的旧结点，不能复用时返回nullptr
+        // LL(1)的展开与上下文无关：同一符号从同一位置开始、看到的记号相同，展开结果就相同
+        std::shared_ptr<TreeNode> find(const std::string& symbol, size_t pos) const {
+            size_t target;
+            bool before = pos < editBegin;
+            if (before)
+                target = pos;
+            else if (pos >= newEnd)
+                target = pos - newEnd + oldEnd;
+            else
+                return nullptr;
+            auto it = nodes.find({symbol, target});
+            if (it == nodes.end())
+                return nullptr;
+            return !before || target + it->second->size < editBegin ? it->second : nullptr;
+        }
+
+        // 在新位置pos处展开的长尾链可以拼接的旧链，start为它在旧记号流中的起始位置
+        std::shared_ptr<TreeNode> chain(const std::string& symbol, size_t pos, size_t& start) const {
+            start = pos <= editBegin ? pos : pos >= newEnd ? pos - newEnd + oldEnd : oldEnd;
+            auto it = nodes.find({symbol, start});
+            return it != nodes.end() ? it->second : nullptr;
+        }
+    };
+
+    // 正在展开的长尾链；内层的链总是先于外层展开完，各链的右链共用一个栈
+    struct Chain {
+        TreeNode* parent;  // 链所在的槽位
+        size_t child;
+        size_t base;                    // 新组成的treap的右链在栈中的起点，spine[base]为根
+        std::shared_ptr<TreeNode> old;  // 用来拼接的旧链
+        size_t oldStart = 0;
+        std::shared_ptr<TreeNode> prefix;  // 从旧链复用的修改之前的组
+        std::shared_ptr<TreeNode> suffix;  // 从旧链复用的修改之后的组
+    };
+
+    // 记下与[editBegin-1, oldEnd]相交的旧结点的非终结符孩子，也就是重新展开时可能复用的结点
+    void indexNodes(const std::shared_ptr<TreeNode>& root, Reuse& reuse) const {
+        size_t lo = reuse.editBegin > 0 ? reuse.editBegin - 1 : 0;
+        reuse.nodes[{root->symbol, 0}] = root;
+        std::vector<std::pair<const TreeNode*, size_t>> work = {{root.get(), 0}};
+        while (!work.empty()) {
+            auto entry = work.back();
+            work.pop_back();
+            forChildren(entry.first, entry.second, lo, reuse.oldEnd, [&](const std::shared_ptr<TreeNode>& child, size_t childStart) {
+                if (nonTerminals.find(child->symbol) == nonTerminals.end())
+                    return;
+                reuse.nodes[{child->symbol, childStart}] = child;
+                if (childStart <= reuse.oldEnd && childStart + child->size > lo)
+                    work.push_back({child.get(), childStart});
+            });
+        }
+    }
+
+    // 依次给出语法结点node的孩子及其起始位置；长尾链只展开与[lo, hi]相交的组
+    template <typename F>
+    void forChildren(const TreeNode* node, size_t start, size_t lo, size_t hi, const F& f) const {
+        if (tails.find(node->symbol) == tails.end()) {
+            for (const auto& child : node->children) {
+                f(child, start);
+                start += child->size;
+            }
+            return;
+        }
+        if (node->children.empty())
+            return;
+        bool left = hasLeft(node), right = hasRight(node);
+        if (left) {
+            const auto& subtree = node->children.front();
+            if (start <= hi && lo < start + subtree->size)
+                forChildren(subtree.get(), start, lo, hi, f);
+            start += subtree->size;
+        }
+        size_t end = node->children.size() - right, groupStart = start;
+        for (size_t i = left; i < end; ++i)
+            start += node->children[i]->size;
+        if (groupStart <= hi && lo < start)
+            for (size_t i = left, childStart = groupStart; i < end; childStart += node->children[i++]->size)
+                f(node->children[i], childStart);
+        if (right && start <= hi)
+            forChildren(node->children.back().get(), start, lo, hi, f);
+    }
+
+    // 复制语法结点node(起始位置start)，把孩子old(起始位置oldStart)换成fresh；长尾链只复制从treap根到所在组的路径
+    std::shared_ptr<TreeNode> replaceChild(const std::shared_ptr<TreeNode>& node, size_t start, const TreeNode* old, size_t oldStart,
+                                           const std::shared_ptr<TreeNode>& fresh) const {
+        auto copy = std::make_shared<TreeNode>(*node);
+        copy->size = copy->size - old->size + fresh->size;
+        bool chain = tails.find(node->symbol) != tails.end();
+        size_t childStart = start;
+        for (auto& child : copy->children) {
+            if (child.get() == old) {
+                child = fresh;
+                break;
+            }
+            if (chain && child->symbol == node->symbol && childStart <= oldStart && oldStart < childStart + child->size) {
+                child = replaceChild(child, childStart, old, oldStart, fresh);
+                break;
+            }
+            childStart += child->size;
+        }
+        return copy;
+    }
+
+    // treap结点(不为空)的左右子树是与自身同名的首尾孩子，其余孩子属于结点自身的组
+    static bool hasLeft(const TreeNode* node) {
+        return node->children.front()->symbol == node->symbol;
+    }
+
+    static bool hasRight(const TreeNode* node) {
+        return node->children.size() > 1 && node->children.back()->symbol == node->symbol;
+    }
+
+    static std::shared_ptr<TreeNode> leftOf(const std::shared_ptr<TreeNode>& node) {
+        return hasLeft(node.get()) ? node->children.front() : nullptr;
+    }
+
+    static std::shared_ptr<TreeNode> rightOf(const std::shared_ptr<TreeNode>& node) {
+        return hasRight(node.get()) ? node->children.back() : nullptr;
+    }
+
+    static size_t sizeOf(const std::shared_ptr<TreeNode>& node) {
+        return node != nullptr ? node->size : 0;
+    }
+
+    // 组的优先级由创建时的起始记号下标散列得到，同样的输入总是得到同样形状的treap；复制treap结点时不变
+    static uint64_t priority(size_t index) {
+        uint64_t x = index + 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdULL;
+        x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return x ^ (x >> 33);
+    }
+
+    // 以node的组为根、left和right为左右子树的treap结点，子树没变时直接返回node
+    static std::shared_ptr<TreeNode> join(const std::shared_ptr<TreeNode>& node, const std::shared_ptr<TreeNode>& left,
+                                          const std::shared_ptr<TreeNode>& right) {
+        auto oldLeft = leftOf(node), oldRight = rightOf(node);
+        if (oldLeft == left && oldRight == right)
+            return node;
+        auto copy = std::make_shared<TreeNode>(node->symbol);
+        copy->priority = node->priority;
+        if (left != nullptr)
+            copy->children.push_back(left);
+        copy->children.insert(copy->children.end(), node->children.begin() + (oldLeft != nullptr), node->children.end() - (oldRight != nullptr));
+        if (right != nullptr)
+            copy->children.push_back(right);
+        copy->size = node->size - sizeOf(oldLeft) - sizeOf(oldRight) + sizeOf(left) + sizeOf(right);
+        return copy;
+    }
+
+    static std::shared_ptr<TreeNode> merge(const std::shared_ptr<TreeNode>& a, const std::shared_ptr<TreeNode>& b) {
+        if (a == nullptr || a->children.empty())
+            return b;
+        if (b == nullptr || b->children.empty())
+            return a;
+        if (a->priority > b->priority)
+            return join(a, leftOf(a), merge(rightOf(a), b));
+        return join(b, merge(a, leftOf(b)), rightOf(b));
+    }
+
+    // 切分起始位置为start的treap：left为结束位置小于limit的组，其余的组在right
+    static void split(const std::shared_ptr<TreeNode>& node, size_t start, size_t limit, std::shared_ptr<TreeNode>& left,
+                      std::shared_ptr<TreeNode>& right) {
+        if (node == nullptr || node->children.empty()) {
+            left = right = nullptr;
+            return;
+        }
+        auto oldLeft = leftOf(node), oldRight = rightOf(node);
+        size_t groupEnd = start + node->size - sizeOf(oldRight);
+        std::shared_ptr<TreeNode> a, b;
+        if (groupEnd < limit) {
+            split(oldRight, groupEnd, limit, a, b);
+            left = join(node, oldLeft, a);
+            right = b;
+        } else {
+            split(oldLeft, start, limit, a, b);
+            left = a;
+            right = join(node, b, oldRight);
+        }
+    }
+
+    // 旧链(起始位置start)中从pos开始的组，pos不是组的起点时返回nullptr
+    static std::shared_ptr<TreeNode> suffix(const std::shared_ptr<TreeNode>& chain, size_t start, size_t pos) {
+        // 先沿treap确认pos是组的起点，再切分
+        const TreeNode* node = chain.get();
+        size_t nodeStart = start;
+        while (true) {
+            if (node == nullptr || node->children.empty())
+                return nullptr;
+            size_t groupStart = nodeStart + (hasLeft(node) ? node->children.front()->size : 0);
+            size_t groupEnd = nodeStart + node->size - (hasRight(node) ? node->children.back()->size : 0);
+            if (pos == groupStart)
+                break;
+            if (pos < groupStart) {
+                node = hasLeft(node) ? node->children.front().get() : nullptr;
+            } else if (pos >= groupEnd) {
+                node = hasRight(node) ? node->children.back().get() : nullptr;
+                nodeStart = groupEnd;
+            } else {
+                return nullptr;
+            }
+        }
+        std::shared_ptr<TreeNode> left, right;
+        split(chain, start, pos + 1, left, right);
+        return right;
+    }
+
+    // 新组按优先级插入正在构建的treap的右链spine[base..]，返回组自身第一个孩子的下标
+    // 只改动新组和右链上孩子都已展开完的组，栈中的槽位不受影响
+    static size_t insert(std::vector<std::shared_ptr<TreeNode>>& spine, size_t base, const std::shared_ptr<TreeNode>& group) {
+        std::shared_ptr<TreeNode> last;
+        while (spine.size() > base && spine.back()->priority < group->priority) {
+            last = spine.back();
+            spine.pop_back();
+        }
+        if (spine.size() > base) {
+            auto& siblings = spine.back()->children;
+            if (last != nullptr)
+                siblings.back() = group;
+            else
+                siblings.push_back(group);
+        }
+        if (last != nullptr)
+            group->children.insert(group->children.begin(), last);
+        spine.push_back(group);
+        return last != nullptr;
+    }
+
+    // 从tokens[index]开始展开symbol，成功时index移到它覆盖的记号之后；记号流之后视为结束符#
+    std::shared_ptr<TreeNode> derive(uint32_t symbol, const std::vector<Lexical::Token>& tokens, const std::string& code, size_t& index,
+                                     const Reuse* reuse) const {
+        Stats::Counter steps("tree.steps");
+        Stats::Counter reused("tree.reused");
+        Stats::Counter stackOps("tree.stack_ops");
+        TreeNode holder("");
+        holder.children.push_back(std::make_shared<TreeNode>(symbolNames[symbol]));
+        // 栈中存放(父结点, 孩子下标)，即父结点孩子列表里的槽位，和槽位上的符号编号；parent为nullptr时表示继续展开第child条长尾链
+        struct Frame {
+            TreeNode* parent;
+            size_t child;
+            uint32_t symbol;
+        };
+        std::vector<Frame> stk = {{&holder, 0, symbol}};
+        std::vector<Chain> chains;
+        std::vector<std::shared_ptr<TreeNode>> spine;
+        std::vector<TreeNode*> merges;
+
+        // 终结符叶子匹配当前记号
+        auto match = [&](TreeNode* leaf) {
+            leaf->lexeme = code.substr(tokens[index].offset, tokens[index].length);
+            leaf->id = tokens[index].symbol;
+            leaf->size = 1;
+            index++;
+        };
+
+        // 孩子从first开始逆序入栈，rhs[i - offset]是第i个孩子的符号；优化后的文法中首终结符就是当前记号，直接匹配
+        auto expand = [&](TreeNode* node, size_t first, const std::vector<uint32_t>& rhs) {
+            size_t offset = first;
+            if (optimized && rhs[0] < endSymbol) {
+                match(node->children[first].get());
+                first++;
+            }
+            for (size_t i = node->children.size(); i-- > first;) {
+                stk.push_back({node, i, rhs[i - offset]});
+                stackOps.value++;
+            }
+        };
+
+        // 链展开完后放回槽位；拼接了旧链的先把各部分挂在槽位的结点下，记号数算完后再合并
+        auto finish = [&]() {
+            const Chain& chain = chains.back();
+            auto& slot = chain.parent->children[chain.child];
+            std::shared_ptr<TreeNode> root = spine.size() > chain.base ? spine[chain.base] : nullptr;
+            if (chain.prefix == nullptr && chain.suffix == nullptr) {
+                if (root != nullptr)
+                    slot = root;
+            } else {
+                for (const auto& part : {chain.prefix, root, chain.suffix})
+                    if (part != nullptr)
+                        slot->children.push_back(part);
+                merges.push_back(slot.get());
+            }
+            spine.resize(chain.base);
+            chains.pop_back();
+        };
+
+        while (!stk.empty()) {
+            Frame frame = stk.back();
+            uint32_t token = kindAt(tokens, index);
+            steps.value++;
+
+            if (frame.parent == nullptr) {
+                Chain& chain = chains[frame.child];
+                const std::string& symbol = symbolNames[frame.symbol];
+                // 修改之后回到旧链的组边界时，旧链剩下的组整体复用
+                if (chain.old != nullptr && index >= reuse->newEnd) {
+                    chain.suffix = suffix(chain.old, chain.oldStart, index - reuse->newEnd + reuse->oldEnd);
+                    if (chain.suffix != nullptr) {
+                        stk.pop_back();
+                        stackOps.value++;
+                        index += chain.suffix->size;
+                        reused.value++;
+                        finish();
+                        continue;
+                    }
+                }
+                int rule = entry(frame.symbol, token);
+                if (rule < 0)
+                    return nullptr;
+                stk.pop_back();
+                stackOps.value++;
+                const auto& production = rules[rule];
+                bool recursive = !production.empty() && production.back() == frame.symbol;
+                if (!production.empty()) {
+                    auto group = std::make_shared<TreeNode>(symbol);
+                    group->priority = priority(index);
+                    for (size_t i = 0; i + recursive < production.size(); ++i)
+                        group->children.push_back(std::make_shared<TreeNode>(symbolNames[production[i]]));
+                    size_t first = insert(spine, chain.base, group);
+                    if (recursive) {
+                        stk.push_back(frame);
+                        stackOps.value++;
+                    }
+                    expand(group.get(), first, production);
+                }
+                if (!recursive)
+                    finish();
+                continue;
+            }
+
+            auto& top = frame.parent->children[frame.child];
+            if (frame.symbol < endSymbol) {
+                if (frame.symbol != token)
+                    return nullptr;
+                match(top.get());
+                stk.pop_back();
+                stackOps.value++;
+            } else if (frame.symbol > endSymbol && frame.symbol != NONE) {
+                std::shared_ptr<TreeNode> old = reuse != nullptr ? reuse->find(top->symbol, index) : nullptr;
+                if (old != nullptr) {
+                    top = old;
+                    stk.pop_back();
+                    stackOps.value++;
+                    index += old->size;
+                    reused.value++;
+                    continue;
+                }
+                if (tailIds[frame.symbol]) {
+                    // 新的长尾链，修改之前的组从旧链整体复用
+                    Chain chain = {frame.parent, frame.child, spine.size(), nullptr, 0, nullptr, nullptr};
+                    if (reuse != nullptr) {
+                        chain.old = reuse->chain(top->symbol, index, chain.oldStart);
+                        if (chain.old != nullptr && index < reuse->editBegin) {
+                            std::shared_ptr<TreeNode> rest;
+                            split(chain.old, index, reuse->editBegin, chain.prefix, rest);
+                            index += sizeOf(chain.prefix);
+                        }
+                    }
+                    chains.push_back(chain);
+                    stk.back() = {nullptr, chains.size() - 1, frame.symbol};
+                    continue;
+                }
+                int rule = entry(frame.symbol, token);
+                if (rule < 0)
+                    return nullptr;
+                stk.pop_back();
+                stackOps.value++;
+                const auto& production = rules[rule];
+                if (production.empty())
+                    continue;
+                for (uint32_t child : production)
+                    top->children.push_back(std::make_shared<TreeNode>(symbolNames[child]));
+                expand(top.get(), 0, production);
+            } else {
+                return nullptr;
+            }
+        }
+
+        // 后序计算新结点覆盖的记号数，复用的子树已经有了
+        std::vector<std::pair<TreeNode*, bool>> order = {{holder.children[0].get(), false}};
+        while (!order.empty()) {
+            auto entry = order.back();
+            order.pop_back();
+            TreeNode* node = entry.first;
+            if (node->size != TreeNode::UNKNOWN)
+                continue;
+            if (!entry.second) {
+                order.push_back({node, true});
+                for (const auto& child : node->children)
+                    order.push_back({child.get(), false});
+            } else {
+                node->size = 0;
+                for (const auto& child : node->children)
+                    node->size += child->size;
+            }
+        }
+
+        // 拼接了旧链的长尾链：各部分的记号数都有了，合并成一个treap，记号数不变
+        for (TreeNode* node : merges) {
+            std::shared_ptr<TreeNode> merged;
+            for (const auto& part : node->children)
+                merged = merge(merged, part);
+            node->children = merged->children;
+            node->priority = merged->priority;
+        }
+        return holder.children[0];
     }
 };
 
+const uint32_t Syntax::NONE;
 #endif  // __SYNTAX_H__
\ No newline at end of file
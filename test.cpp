@@ -0,0 +1,216 @@
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "binfmt.h"
+#include "lang.h"
+#include "lexical.h"
+#include "syntax.h"
+
+// make test：在ASan/UBSan下运行，任何一项失败时返回非0
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cout << "FAIL " << what << "\n";
+        failures++;
+    }
+}
+
+// 非ASCII标识符整体是一个记号；非法的UTF-8字节不并入标识符，各自成为不属于任何规则的记号
+void testUnicode(const Lexical& lexical) {
+    struct Case {
+        std::string code;
+        std::vector<std::pair<int, std::string>> tokens;
+    };
+    const std::vector<Case> cases = {
+        {"变量+naïve", {{Identifier, "变量"}, {Operator, "+"}, {Identifier, "naïve"}}},
+        {"Ωmega_２ 한글", {{Identifier, "Ωmega_２"}, {-1, " "}, {Identifier, "한글"}}},
+        {"x\xC3y", {{Identifier, "x"}, {-1, "\xC3"}, {Identifier, "y"}}},                            // 缺续字节
+        {"\xC0\x80", {{-1, "\xC0"}, {-1, "\x80"}}},                                                   // 过长编码
+        {"a\xED\xA0\x80", {{Identifier, "a"}, {-1, "\xED"}, {-1, "\xA0"}, {-1, "\x80"}}},             // 代理区
+        {"\xF5\x80\x80\x80", {{-1, "\xF5"}, {-1, "\x80"}, {-1, "\x80"}, {-1, "\x80"}}},               // 超出U+10FFFF
+        {"a\xE3\x80\x80" "b", {{Identifier, "a"}, {-1, "\xE3"}, {-1, "\x80"}, {-1, "\x80"}, {Identifier, "b"}}},  // U+3000不是字母
+    };
+    for (const auto& c : cases) {
+        auto tokens = lexical.scan(c.code);
+        check(tokens == c.tokens, "unicode scan of \"" + c.code + "\"");
+    }
+}
+
+// 把与结点同名的孩子(长尾链treap的左右子树)展开后逐层比较，不受treap形状的影响
+void flatChildren(const Syntax::TreeNode* node, std::vector<const Syntax::TreeNode*>& out) {
+    for (const auto& child : node->children)
+        if (child->symbol == node->symbol)
+            flatChildren(child.get(), out);
+        else
+            out.push_back(child.get());
+}
+
+bool sameTree(const Syntax::TreeNode* a, const Syntax::TreeNode* b) {
+    std::vector<const Syntax::TreeNode*> left, right;
+    flatChildren(a, left);
+    flatChildren(b, right);
+    if (a->symbol != b->symbol || a->lexeme != b->lexeme || a->size != b->size || left.size() != right.size())
+        return false;
+    for (size_t i = 0; i < left.size(); ++i)
+        if (!sameTree(left[i], right[i]))
+            return false;
+    return true;
+}
+
+// 逐个结点比较，treap形状也必须一致
+bool identical(const Syntax::TreeNode* a, const Syntax::TreeNode* b) {
+    if (a->symbol != b->symbol || a->lexeme != b->lexeme || a->size != b->size || a->children.size() != b->children.size())
+        return false;
+    for (size_t i = 0; i < a->children.size(); ++i)
+        if (!identical(a->children[i].get(), b->children[i].get()))
+            return false;
+    return true;
+}
+
+// 把记号[at, at + remove)换成text后的源码，text两边加空格，不和相邻的记号连成一个
+std::string splice(const std::string& code, const std::vector<Lexical::Token>& tokens, size_t at, size_t remove, const std::string& text) {
+    size_t begin = at < tokens.size() ? tokens[at].offset : code.size();
+    size_t end = at + remove < tokens.size() ? tokens[at + remove].offset : code.size();
+    return code.substr(0, begin) + " " + text + " " + code.substr(end);
+}
+
+// 记号的种别是终结符编号，诊断信息里的词素从源码中取出；关键字不是终结符
+void testParse(const Lexical& lexical) {
+    struct Case {
+        std::string code;
+        bool accepted;
+        std::string diagnostics;
+    };
+    const std::vector<Case> cases = {
+        {"a + b * (2 - c)", true, ""},
+        {"x +", false, "Syntax error: no production rule for (T, #)\n"},
+        {"x y", false, "Syntax error: no production rule for (T', y)\n"},
+        {"(x", false, "Syntax error: unexpected token #, expected )\n"},
+        {")", false, "Syntax error: no production rule for (E, ))\nSyntax error: unexpected token ), expected #\n"},  // 同步恢复后仍然失败
+        {"int + 1", false, "Syntax error: no production rule for (E, int)\n"},
+        {"1 + (2 *)", false, "Syntax error: no production rule for (F, ))\n"},
+    };
+    Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol);
+    for (const auto& c : cases) {
+        auto tokens = classifyTokens(lexical.scanTokens(c.code), c.code, syntax);
+        std::ostringstream out;
+        bool accepted = syntax.parse(tokens, c.code, out, false);
+        check(accepted == c.accepted && out.str() == c.diagnostics, "parse of \"" + c.code + "\": " + out.str());
+        check(accepted == (syntax.buildTree(tokens, c.code) != nullptr), "buildTree agrees with parse on \"" + c.code + "\"");
+    }
+}
+
+// 长的E'链中间夹一条长的T'链，在两条链的开头、中间、结尾替换、插入、删除记号，reparse的结果须与重新buildTree一致
+void testReparse(const Lexical& lexical) {
+    const int n = 600;
+    std::string code = "a0";
+    for (int i = 1; i < n; ++i)
+        code += "+a" + std::to_string(i);
+    code += "+p0";
+    for (int i = 1; i < n; ++i)
+        code += "*p" + std::to_string(i);
+    for (int i = 0; i < n; ++i)
+        code += "-b" + std::to_string(i);
+    auto scanned = lexical.scanTokens(code);
+
+    struct Edit {
+        size_t remove;
+        std::string insert;
+        size_t inserted;  // 插入的记号数
+    };
+    const std::vector<Edit> edits = {
+        {1, "z", 1},      // 替换一个记号
+        {0, "+ y", 2},    // 插入一项
+        {0, "* 2", 2},    // 插入一个因子
+        {2, "", 0},       // 删除两个记号
+        {1, "", 0},       // 删除一个记号，多半产生语法错误
+    };
+
+    for (bool optimize : {false, true}) {
+        Syntax syntax = Syntax(productions, terminals, nonTerminals, startSymbol, optimize);
+        std::string name = optimize ? "optimized" : "plain";
+        auto tokens = classifyTokens(scanned, code, syntax);
+        auto find = [&](const std::string& lexeme) {
+            for (size_t i = 0; i < tokens.size(); ++i)
+                if (code.compare(tokens[i].offset, tokens[i].length, lexeme) == 0)
+                    return i;
+            return tokens.size();
+        };
+        std::vector<size_t> positions = {0, find("a300"), find("p0"), find("p300"), find("p599"), find("b300"), tokens.size() - 1};
+
+        auto tree = syntax.buildTree(tokens, code);
+        auto again = syntax.buildTree(tokens, code);
+        check(tree != nullptr && again != nullptr, name + " buildTree of long chains");
+        if (tree == nullptr || again == nullptr)
+            continue;
+        check(identical(tree.get(), again.get()), name + " treap shape is deterministic");
+
+        for (size_t at : positions) {
+            for (const auto& edit : edits) {
+                if (at + edit.remove > tokens.size())
+                    continue;
+                std::string source = splice(code, tokens, at, edit.remove, edit.insert);
+                auto edited = classifyTokens(lexical.scanTokens(source), source, syntax);
+                std::string what = name + " reparse at " + std::to_string(at) + " removing " + std::to_string(edit.remove) +
+                                   " inserting \"" + edit.insert + "\"";
+                check(edited.size() == tokens.size() - edit.remove + edit.inserted, what + " token count");
+                auto full = syntax.buildTree(edited, source);
+                auto incremental = syntax.reparse(tree, edited, source, at, at + edit.remove, at + edit.inserted);
+                check((full == nullptr) == (incremental == nullptr), what + " agrees on errors");
+                if (full != nullptr && incremental != nullptr)
+                    check(sameTree(full.get(), incremental.get()), what);
+            }
+        }
+    }
+}
+
+// 经管道写出再读回
+BinaryReader roundTrip(BinaryWriter& writer, int fds[2]) {
+    bool ok = writer.finish();
+    close(fds[1]);
+    std::string data;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        data.append(buffer, n);
+    close(fds[0]);
+    check(ok, "binary writer finish");
+    return BinaryReader(data);
+}
+
+// 空的记号流和空的符号表也要能读写，读取时不把空vector的data()交给memcpy
+void testBinaryEmpty() {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        check(false, "pipe");
+        return;
+    }
+    BinaryWriter writer(fds[1]);
+    writer.symbols({});
+    writer.verdict(true);
+    try {
+        BinaryReader reader = roundTrip(writer, fds);
+        check(reader.kinds.empty() && reader.tokens.empty(), "empty token stream round trip");
+        check(reader.symbols.empty() && reader.tokenSymbols.empty(), "empty symbol table round trip");
+        check(reader.accepted && reader.diagnostics.empty(), "empty stream verdict round trip");
+    } catch (const std::exception& e) {
+        check(false, std::string("empty binary round trip: ") + e.what());
+    }
+}
+
+int main() {
+    Lexical lexical = Lexical(rgexList);
+    testUnicode(lexical);
+    testParse(lexical);
+    testReparse(lexical);
+    testBinaryEmpty();
+    if (failures == 0)
+        std::cout << "all tests passed\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -1,94 +1,427 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
+#include <algorithm>
+#include <bitset>
+#include <cctype>
 #include <iostream>
-#include <stack>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
+
+#include "stats.h"
+
+// UTF-8编码与码点区间拆分
+class Utf8 {
+   public:
+    typedef std::vector<std::pair<unsigned char, unsigned char>> Sequence;  // 每个字节的取值区间
+
+    static std::string encode(unsigned cp) {
+        std::string s;
+        if (cp < 0x80) {
+            s += (char)cp;
+        } else if (cp < 0x800) {
+            s += (char)(0xC0 | (cp >> 6));
+            s += (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            s += (char)(0xE0 | (cp >> 12));
+            s += (char)(0x80 | ((cp >> 6) & 0x3F));
+            s += (char)(0x80 | (cp & 0x3F));
+        } else {
+            s += (char)(0xF0 | (cp >> 18));
+            s += (char)(0x80 | ((cp >> 12) & 0x3F));
+            s += (char)(0x80 | ((cp >> 6) & 0x3F));
+            s += (char)(0x80 | (cp & 0x3F));
+        }
+        return s;
+    }
+
+    // 把码点区间[lo, hi]拆成若干字节序列，每个序列的每一位都是连续的字节区间
+    // 例如 [0x80, 0x7FF] -> [C2-DF][80-BF]
+    static void split(unsigned lo, unsigned hi, std::vector<Sequence>& out) {
+        if (lo > hi)
+            return;
+        if (hi > 0x10FFFF)
+            hi = 0x10FFFF;
+        // 跳过代理区
+        if (lo <= 0xDFFF && hi >= 0xD800) {
+            if (lo < 0xD800)
+                split(lo, 0xD7FF, out);
+            if (hi > 0xDFFF)
+                split(0xE000, hi, out);
+            return;
+        }
+        // 按编码长度切开
+        for (unsigned max : {0x7Fu, 0x7FFu, 0xFFFFu}) {
+            if (lo <= max && max < hi) {
+                split(lo, max, out);
+                split(max + 1, hi, out);
+                return;
+            }
+        }
+        if (hi < 0x80) {
+            out.push_back({{(unsigned char)lo, (unsigned char)hi}});
+            return;
+        }
+        // 使低位的续字节都能取满 [80-BF]
+        for (int i = 1; i < 4; ++i) {
+            unsigned m = (1u << (6 * i)) - 1;
+            if ((lo & ~m) != (hi & ~m)) {
+                if ((lo & m) != 0) {
+                    split(lo, lo | m, out);
+                    split((lo | m) + 1, hi, out);
+                    return;
+                }
+                if ((hi & m) != m) {
+                    split(lo, (hi & ~m) - 1, out);
+                    split(hi & ~m, hi, out);
+                    return;
+                }
+            }
+        }
+        std::string a = encode(lo), b = encode(hi);
+        Sequence seq;
+        for (size_t i = 0; i < a.size(); ++i)
+            seq.push_back({(unsigned char)a[i], (unsigned char)b[i]});
+        out.push_back(seq);
+    }
+};
+
+// 正则表达式的语法树
+// 语法：| * + ? {m} {m,} {m,n} ( ) [a-z] [^...] \u{XXXX-YYYY}
+// '@'表示空串，'.'是普通字符，其余元字符用'\\'转义；\n \t \r 为控制字符
 class Rgex {
    public:
-    struct RgexToken {
-        char c;   // 符号
-        bool op;  // 是不是正则的运算符
-        RgexToken(char c, bool op) : c(c), op(op) {}
+    struct Ast {
+        enum Kind {
+            EMPTY,   // 空串
+            BYTES,   // 字节集合中的任意一个字节
+            CONCAT,  // 连接
+            ALT,     // 选择
+            REPEAT,  // 重复 {min,max}，max为-1表示无上限
+        };
+
+        Kind kind;
+        std::bitset<256> bytes;
+        std::vector<std::shared_ptr<Ast>> children;
+        int min = 0;
+        int max = 0;
+
+        Ast(Kind kind) : kind(kind) {
+        }
     };
 
-    static int priority(char c) {
-        if (c == '|')
-            return 1;
-        else if (c == '.')
-            return 2;
-        else if (c == '*')
-            return 3;
-        else
-            return -1;
-    }
-
-    // 转逆波兰表达式
-    static std::vector<RgexToken> toRPN(const std::string& infix) {
-        std::stack<char> st;
-        std::vector<RgexToken> tokens;
-
-        // 1.先全部转成token
-        for (int i = 0; i < infix.length(); ++i) {
-            char c = infix[i];
-            // 处理转义字符
-            if (c == '\\')
-                tokens.push_back(RgexToken(infix[++i], false));
-            else if (c == '*' || c == '|' || c == '(' || c == ')')
-                tokens.push_back(RgexToken(c, true));
-            else
-                tokens.push_back(RgexToken(c, false));
+    static const int MAX_REPEAT = 1000;
+
+    // 递归下降，一遍扫描构建语法树
+    static std::shared_ptr<Ast> parse(const std::string& rgex) {
+        Stats::Scope scope("rgex.parse");
+        Rgex parser(rgex);
+        auto ast = parser.parseAlt();
+        if (parser.pos != rgex.size())
+            parser.fail("unexpected ')'");
+        return ast;
+    }
+
+   private:
+    typedef std::vector<std::pair<unsigned, unsigned>> Ranges;  // 码点区间
+
+    const std::string& rgex;
+    size_t pos = 0;
+
+    Rgex(const std::string& rgex) : rgex(rgex) {
+    }
+
+    void fail(const std::string& message) const {
+        throw std::runtime_error("bad regex \"" + rgex + "\" at " + std::to_string(pos) + ": " + message);
+    }
+
+    bool more() const {
+        return pos < rgex.size();
+    }
+
+    char peek() const {
+        return rgex[pos];
+    }
+
+    std::shared_ptr<Ast> parseAlt() {
+        auto first = parseConcat();
+        if (!more() || peek() != '|')
+            return first;
+        auto alt = std::make_shared<Ast>(Ast::ALT);
+        alt->children.push_back(first);
+        while (more() && peek() == '|') {
+            pos++;
+            alt->children.push_back(parseConcat());
         }
+        return alt;
+    }
 
-        // 2.处理缺少'.'运算符
-        for (int i = 0; i < tokens.size(); ++i) {
-            RgexToken token = tokens[i];
-            if (token.op) {
-                if (i + 1 < tokens.size() && token.c != '(' && tokens[i + 1].c != ')' && token.c != '|' && tokens[i + 1].c != '|' && tokens[i + 1].c != '*')
-                    tokens.insert(tokens.begin() + ++i, RgexToken('.', true));
-                else if (i + 1 < tokens.size() && !tokens[i + 1].op && token.c != '(' && token.c != '|')
-                    tokens.insert(tokens.begin() + ++i, RgexToken('.', true));
-            } else {
-                if (i + 1 < tokens.size())
-                    if (tokens[i + 1].op && tokens[i + 1].c == '(')
-                        tokens.insert(tokens.begin() + ++i, RgexToken('.', true));
-                    else if (!tokens[i + 1].op)
-                        tokens.insert(tokens.begin() + ++i, RgexToken('.', true));
+    std::shared_ptr<Ast> parseConcat() {
+        auto concat = std::make_shared<Ast>(Ast::CONCAT);
+        while (more() && peek() != '|' && peek() != ')')
+            concat->children.push_back(parseRepeat());
+        if (concat->children.size() == 1)
+            return concat->children[0];
+        if (concat->children.empty())
+            return std::make_shared<Ast>(Ast::EMPTY);
+        return concat;
+    }
+
+    std::shared_ptr<Ast> parseRepeat() {
+        auto atom = parseAtom();
+        while (more()) {
+            int min = 0, max = 0;
+            char c = peek();
+            if (c == '*') {
+                min = 0, max = -1;
+                pos++;
+            } else if (c == '+') {
+                min = 1, max = -1;
+                pos++;
+            } else if (c == '?') {
+                min = 0, max = 1;
+                pos++;
+            } else if (c != '{' || !parseBounds(min, max)) {
+                break;
             }
+            auto repeat = std::make_shared<Ast>(Ast::REPEAT);
+            repeat->children.push_back(atom);
+            repeat->min = min;
+            repeat->max = max;
+            atom = repeat;
         }
+        return atom;
+    }
 
-        // 3. 转后缀表达式
-        std::vector<RgexToken> res;
+    // {m} {m,} {m,n}；不是这几种形式时'{'按普通字符处理
+    bool parseBounds(int& min, int& max) {
+        size_t end = rgex.find('}', pos);
+        if (end == std::string::npos)
+            return false;
+        std::string body = rgex.substr(pos + 1, end - pos - 1);
+        size_t comma = body.find(',');
+        std::string lo = body.substr(0, comma);
+        std::string hi = comma == std::string::npos ? lo : body.substr(comma + 1);
+        auto digits = [](const std::string& s) { return s.find_first_not_of("0123456789") == std::string::npos; };
+        if (lo.empty() || !digits(lo) || !digits(hi) || lo.size() > 4 || hi.size() > 4)
+            return false;
+        min = std::stoi(lo);
+        max = hi.empty() ? -1 : std::stoi(hi);
+        if ((max != -1 && max < min) || min > MAX_REPEAT || max > MAX_REPEAT)
+            fail("bad repetition bounds");
+        pos = end + 1;
+        return true;
+    }
 
-        std::stack<RgexToken> operStack;
+    std::shared_ptr<Ast> parseAtom() {
+        char c = peek();
+        if (c == '(') {
+            pos++;
+            auto inner = parseAlt();
+            if (!more() || peek() != ')')
+                fail("missing ')'");
+            pos++;
+            return inner;
+        } else if (c == '[') {
+            pos++;
+            return parseClass();
+        } else if (c == '@') {
+            pos++;
+            return std::make_shared<Ast>(Ast::EMPTY);
+        } else if (c == '*' || c == '+' || c == '?') {
+            fail("nothing to repeat");
+        } else if (c == '\\' && rgex.compare(pos + 1, 2, "u{") == 0) {
+            Ranges ranges;
+            unsigned lo, hi;
+            parseCodePoints(lo, hi);
+            ranges.push_back({lo, hi});
+            return fromRanges(ranges);
+        }
+        auto bytes = std::make_shared<Ast>(Ast::BYTES);
+        bytes->bytes.set((unsigned char)parseChar());
+        return bytes;
+    }
 
-        for (int i = 0; i < tokens.size(); ++i) {
-            RgexToken token = tokens[i];
-            if (!token.op) {
-                res.push_back(token);
-            } else if (token.c == '(') {
-                operStack.push(token);
-            } else if (token.c == ')') {
-                while (operStack.top().c != '(') {
-                    res.push_back(operStack.top());
-                    operStack.pop();
-                }
-                operStack.pop();
+    // 单个字符，处理转义
+    char parseChar() {
+        char c = rgex[pos++];
+        if (c != '\\')
+            return c;
+        if (!more())
+            fail("trailing '\\'");
+        c = rgex[pos++];
+        if (c == 'n')
+            return '\n';
+        if (c == 't')
+            return '\t';
+        if (c == 'r')
+            return '\r';
+        return c;
+    }
+
+    // \u{XXXX} 或 \u{XXXX-YYYY}
+    void parseCodePoints(unsigned& lo, unsigned& hi) {
+        size_t end = rgex.find('}', pos);
+        if (end == std::string::npos)
+            fail("missing '}'");
+        pos += 3;
+        lo = hi = parseHex(end);
+        if (pos < end && peek() == '-') {
+            pos++;
+            hi = parseHex(end);
+        }
+        if (pos != end)
+            fail("bad code point");
+        if (lo > hi || hi > 0x10FFFF)
+            fail("bad code point range");
+        pos = end + 1;
+    }
+
+    // 1~6位十六进制数，不超过end
+    unsigned parseHex(size_t end) {
+        size_t begin = pos;
+        unsigned value = 0;
+        while (pos < end && pos - begin < 6 && std::isxdigit((unsigned char)peek())) {
+            char c = peek();
+            value = value * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+            pos++;
+        }
+        if (pos == begin)
+            fail("expected hex digits");
+        return value;
+    }
+
+    // 类中的一个码点：转义、\u{}或UTF-8编码的字符
+    unsigned parseClassCodePoint() {
+        unsigned char c = rgex[pos];
+        if (c < 0x80 || c >= 0xF8)
+            return (unsigned char)parseChar();
+        int n = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+        unsigned cp = c & (0x3F >> n);
+        pos++;
+        for (int i = 0; i < n && more(); ++i)
+            cp = (cp << 6) | (rgex[pos++] & 0x3F);
+        return cp;
+    }
+
+    // [a-z_] [^"\n] [\u{4E00-9FFF}]，取反时对全部码点取补
+    std::shared_ptr<Ast> parseClass() {
+        bool negate = more() && peek() == '^';
+        if (negate)
+            pos++;
+        Ranges ranges;
+        bool first = true;
+        while (true) {
+            if (!more())
+                fail("missing ']'");
+            if (peek() == ']' && !first)
+                break;
+            first = false;
+            unsigned lo, hi;
+            if (rgex.compare(pos, 3, "\\u{") == 0) {
+                parseCodePoints(lo, hi);
             } else {
-                while (operStack.size() != 0 && priority(token.c) <= priority(operStack.top().c)) {
-                    res.push_back(operStack.top());
-                    operStack.pop();
+                lo = hi = parseClassCodePoint();
+                if (pos + 1 < rgex.size() && peek() == '-' && rgex[pos + 1] != ']') {
+                    pos++;
+                    hi = parseClassCodePoint();
+                    if (hi < lo)
+                        fail("bad class range");
                 }
-                operStack.push(token);
             }
+            ranges.push_back({lo, hi});
         }
+        pos++;
 
-        while (!operStack.empty()) {
-            res.push_back(operStack.top());
-            operStack.pop();
+        std::sort(ranges.begin(), ranges.end());
+        if (negate) {
+            Ranges complement;
+            unsigned next = 0;
+            for (auto r : ranges) {
+                if (r.first > next)
+                    complement.push_back({next, r.first - 1});
+                next = std::max(next, r.second + 1);
+            }
+            if (next <= 0x10FFFF)
+                complement.push_back({next, 0x10FFFF});
+            ranges = complement;
+        }
+        return fromRanges(ranges);
+    }
+
+    // 码点区间集合 -> ASCII部分合成一个字节集合，其余部分按UTF-8字节序列展开
+    // 重叠或相邻的区间先合并，拆出的字节序列更少
+    static std::shared_ptr<Ast> fromRanges(Ranges ranges) {
+        std::sort(ranges.begin(), ranges.end());
+        Ranges merged;
+        for (auto r : ranges) {
+            if (!merged.empty() && r.first <= merged.back().second + 1)
+                merged.back().second = std::max(merged.back().second, r.second);
+            else
+                merged.push_back(r);
+        }
+        auto ascii = std::make_shared<Ast>(Ast::BYTES);
+        std::vector<Utf8::Sequence> seqs;
+        for (auto r : merged) {
+            for (unsigned c = r.first; c <= r.second && c < 0x80; ++c)
+                ascii->bytes.set(c);
+            if (r.second >= 0x80)
+                Utf8::split(std::max(r.first, 0x80u), r.second, seqs);
         }
+        auto alt = fromSequences(seqs, 0, seqs.size(), 0);
+        if (ascii->bytes.any())
+            alt->children.insert(alt->children.begin(), ascii);
+        if (alt->children.size() == 1)
+            return alt->children[0];
+        return alt;
+    }
+
+    static std::shared_ptr<Ast> byteRange(std::pair<unsigned char, unsigned char> range) {
+        auto bytes = std::make_shared<Ast>(Ast::BYTES);
+        for (unsigned b = range.first; b <= range.second; ++b)
+            bytes->bytes.set(b);
+        return bytes;
+    }
+
+    // seqs[begin, end)从第depth个字节起的部分，相邻且该字节区间相同的序列合并成 [区间](后续部分的选择)
+    // 码点区间按顺序拆分，共享前缀的序列是相邻的；合并后NFA的分支少得多
+    static std::shared_ptr<Ast> fromSequences(const std::vector<Utf8::Sequence>& seqs, size_t begin, size_t end, size_t depth) {
+        auto alt = std::make_shared<Ast>(Ast::ALT);
+        for (size_t i = begin; i < end;) {
+            size_t j = i + 1;
+            while (j < end && seqs[j].size() == seqs[i].size() && seqs[j][depth] == seqs[i][depth])
+                j++;
+            auto concat = std::make_shared<Ast>(Ast::CONCAT);
+            concat->children.push_back(byteRange(seqs[i][depth]));
+            if (depth + 1 < seqs[i].size()) {
+                auto rest = fromSequences(seqs, i, j, depth + 1);
+                concat->children.push_back(rest->children.size() == 1 ? rest->children[0] : rest);
+            }
+            // 后续部分相同的分支合并成一个，首字节取并集：[E1](X)|[E2](X) -> [E1E2](X)
+            bool merged = false;
+            for (auto& other : alt->children) {
+                bool single = other->kind == Ast::BYTES;
+                if (single != (concat->children.size() == 1) || (!single && !same(other->children[1], concat->children[1])))
+                    continue;
+                (single ? other : other->children[0])->bytes |= concat->children[0]->bytes;
+                merged = true;
+                break;
+            }
+            if (!merged)
+                alt->children.push_back(concat->children.size() == 1 ? concat->children[0] : concat);
+            i = j;
+        }
+        return alt;
+    }
 
-        return res;
+    static bool same(const std::shared_ptr<Ast>& a, const std::shared_ptr<Ast>& b) {
+        if (a->kind != b->kind || a->bytes != b->bytes || a->min != b->min || a->max != b->max || a->children.size() != b->children.size())
+            return false;
+        for (size_t i = 0; i < a->children.size(); ++i)
+            if (!same(a->children[i], b->children[i]))
+                return false;
+        return true;
     }
 };
 